@@ -0,0 +1,377 @@
+///
+/// @brief Parse and lookup benchmarks for the Simplestream classes.
+/// @details Each result reports wall time along with the heap allocations
+/// made through an interposed global operator new, and hardware counters read
+/// with perf_event_open when the kernel allows it.
+///
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "simplestream.h"
+#include "bench.h"
+
+namespace {
+
+std::atomic<std::uint64_t> g_allocs{0};
+std::atomic<std::uint64_t> g_allocBytes{0};
+
+} // namespace
+
+// Count every heap allocation in the bench binary. Array and nothrow forms
+//  forward to these in libstdc++.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new(std::size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+#pragma GCC diagnostic pop
+
+namespace {
+
+///
+/// @brief Hardware counters for the calling thread, read with perf_event_open.
+/// @details Each counter is opened on its own so that one the kernel or
+/// hypervisor doesn't support (common in VMs) doesn't hide the others.
+///
+class PerfCounters {
+public:
+    enum Counter { Cycles, Instructions, CacheMisses, BranchMisses, Count };
+    using Values = std::array<std::int64_t, Count>;
+    static_assert(Count == COUNTER_NAMES.size());
+
+    PerfCounters() {
+        constexpr std::array<std::uint64_t, Count> configs = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < Count; ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+    }
+
+    ~PerfCounters() {
+        for (int fd : m_fds) {
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+
+    void start() {
+        for (int fd : m_fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    /// @return the counts since start(), or -1 for unavailable counters
+    Values stop() {
+        Values ret;
+        for (int i = 0; i < Count; ++i) {
+            ret[i] = -1;
+            if (m_fds[i] < 0)
+                continue;
+            ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            std::uint64_t count = 0;
+            if (read(m_fds[i], &count, sizeof(count)) == sizeof(count))
+                ret[i] = static_cast<std::int64_t>(count);
+        }
+        return ret;
+    }
+
+private:
+    PerfCounters(const PerfCounters&) = delete;
+
+    std::array<int, Count> m_fds;
+};
+
+// Keeps the compiler from discarding benchmarked work.
+volatile std::size_t g_sink = 0;
+
+///
+/// @brief Run `body` `runs` times, where each run performs `opsPerRun`
+/// operations. Each run is timed as a sample, while allocations and counters
+/// are measured over all runs.
+///
+Result measure(PerfCounters &perf, const std::string &name, int runs,
+               std::uint64_t opsPerRun, const std::function<void()> &body)
+{
+    body(); // Warm up caches and lazily built state.
+
+    Result ret;
+    ret.name = name;
+    ret.ops = opsPerRun * static_cast<std::uint64_t>(runs);
+    ret.samples.reserve(static_cast<std::size_t>(runs));
+
+    const auto allocs = g_allocs.load(std::memory_order_relaxed);
+    const auto bytes = g_allocBytes.load(std::memory_order_relaxed);
+    perf.start();
+    for (int i = 0; i < runs; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        ret.samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count() /
+                              static_cast<double>(opsPerRun));
+    }
+    const auto counters = perf.stop();
+
+    const double ops = static_cast<double>(ret.ops);
+    ret.allocsPerOp = static_cast<double>(g_allocs.load(std::memory_order_relaxed) - allocs) / ops;
+    ret.bytesPerOp = static_cast<double>(g_allocBytes.load(std::memory_order_relaxed) - bytes) / ops;
+    for (int i = 0; i < PerfCounters::Count; ++i) {
+        ret.countersPerOp[i] = counters[i] < 0 ? -1 : static_cast<double>(counters[i]) / ops;
+    }
+    return ret;
+}
+
+void printResults(const std::vector<Result> &results)
+{
+    std::cout << std::left << std::setw(24) << "benchmark" << std::right
+              << std::setw(10) << "ops" << std::setw(14) << "ns/op"
+              << std::setw(12) << "allocs/op" << std::setw(12) << "bytes/op";
+    for (const char *name : COUNTER_NAMES) {
+        std::cout << std::setw(18) << (std::string(name) + "/op");
+    }
+    std::cout << '\n' << std::fixed << std::setprecision(1);
+    for (const auto &res : results) {
+        std::cout << std::left << std::setw(24) << res.name << std::right
+                  << std::setw(10) << res.ops << std::setw(14) << res.mean()
+                  << std::setw(12) << res.allocsPerOp << std::setw(12) << res.bytesPerOp;
+        for (double count : res.countersPerOp) {
+            if (count < 0)
+                std::cout << std::setw(18) << "n/a";
+            else
+                std::cout << std::setw(18) << count;
+        }
+        std::cout << '\n';
+    }
+}
+
+///
+/// @brief Every alias and version of the document's products, which the
+/// lookup benchmarks query by.
+///
+std::vector<std::string> collectQueries(const Simplestream &stream)
+{
+    std::vector<std::string> ret;
+    for (const auto &prod : stream.getProducts()) {
+        if (const auto aliases = prod.tryGetAliases()) {
+            for (auto alias : *aliases | std::views::split(',')) {
+                ret.emplace_back(alias.begin(), alias.end());
+            }
+        }
+        if (const auto version = prod.tryGetVersion()) {
+            ret.push_back("Ubuntu-" + *version);
+        }
+    }
+    return ret;
+}
+
+///
+/// @brief A copy of `document` where every other product is malformed, to
+/// show that malformed entries don't slow down lookups of the others.
+///
+std::string malformDocument(const std::string &document)
+{
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(document, root))
+        throw std::runtime_error(reader.getFormattedErrorMessages());
+    bool malform = false;
+    for (auto &prod : root["products"]) {
+        if (malform) {
+            prod["aliases"] = 0;
+            prod["versions"] = Json::nullValue;
+        }
+        malform = !malform;
+    }
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    return Json::writeString(writer, root);
+}
+
+void printUsage()
+{
+    std::cout << "Usage: simplestream_bench [-o <results.json>] <document.json> [runs]\n";
+    std::cout << "       simplestream_bench [-o <results.json>] startup <document.json> <simplestream> [runs]\n";
+    std::cout << "       simplestream_bench [-o <results.json>] [-p <probability>] faults <document.json> <simplestream> [runs]\n";
+    std::cout << "       simplestream_bench compare <baseline.json> <candidate.json>\n";
+    std::cout << "Benchmark parsing and querying a Simplestream JSON document, or the\n";
+    std::cout << "startup latency of the simplestream binary, also under injected faults.\n";
+    std::cout << "Results can be saved and compared against a baseline.\n\n";
+    std::cout << "  -o, --output <results.json>  Save results with environment metadata\n";
+    std::cout << "  -p, --probability <p>        Fault probability per request (default 0.2)\n";
+}
+
+///
+/// @brief Benchmark parsing and querying `document` in-process.
+/// @return exit status
+///
+int runParse(const std::string &document, int runs, std::vector<Result> &results)
+{
+    PerfCounters perf;
+
+    results.push_back(measure(perf, "parse", runs, 1, [&] {
+        Simplestream stream(document);
+        g_sink = g_sink + stream.getProducts().size();
+    }));
+
+    const Simplestream stream(document);
+    const auto queries = collectQueries(stream);
+    if (queries.empty()) {
+        std::cout << "error: Document has no products to query" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // Lookups are cheap, so run them many more times than the parse.
+    const int lookupRuns = runs * 50;
+
+    results.push_back(measure(perf, "getProducts", lookupRuns, 1, [&] {
+        g_sink = g_sink + stream.getProducts().size();
+    }));
+
+    results.push_back(measure(perf, "findProduct", lookupRuns, queries.size(), [&] {
+        for (const auto &query : queries) {
+            g_sink = g_sink + !!stream.findProduct(query);
+        }
+    }));
+
+    results.push_back(measure(perf, "findProduct (miss)", lookupRuns, 1, [&] {
+        g_sink = g_sink + !!stream.findProduct("no-such-release");
+    }));
+
+    const auto products = stream.getProducts();
+    results.push_back(measure(perf, "tryGetItemInfo", lookupRuns, products.size(), [&] {
+        for (const auto &prod : products) {
+            g_sink = g_sink + prod.tryGetItemInfo(IMAGE_TAG).has_value();
+        }
+    }));
+
+    const Simplestream malformed(malformDocument(document));
+    results.push_back(measure(perf, "findProduct (malformed)", lookupRuns, queries.size(), [&] {
+        for (const auto &query : queries) {
+            const auto prod = malformed.findProduct(query);
+            g_sink = g_sink + (prod && prod.tryGetItemInfo(IMAGE_TAG).has_value());
+        }
+    }));
+
+    printResults(results);
+    return EXIT_SUCCESS;
+}
+
+} // namespace
+
+std::string readFile(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Cannot open " + path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+///
+/// @brief Benchmarks for parsing and querying a Simplestream document read
+/// from disk, and for the startup latency of the simplestream binary
+/// @return exit status
+///
+int main(int argc, char *argv[])
+{
+    // Vectorize command line arguments, taking out the options.
+    std::vector<std::string> args;
+    std::string output;
+    double probability = 0.2;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "-o" || arg == "--output") {
+            if (++i == argc) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+            output = argv[i];
+        } else if (arg == "-p" || arg == "--probability") {
+            if (++i == argc) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+            probability = std::atof(argv[i]);
+            if (probability < 0 || probability > 1) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+        } else {
+            args.emplace_back(arg);
+        }
+    }
+
+    if (!args.empty() && args[0] == "compare") {
+        if (args.size() != 3 || !output.empty()) {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+        try {
+            return runCompare(readFile(args[1]), readFile(args[2]));
+        } catch (const std::runtime_error& err) {
+            std::cout << "error: " << err.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::string mode = !args.empty() && (args[0] == "startup" || args[0] == "faults") ? args[0] : "parse";
+    const std::size_t positional = mode == "parse" ? 1 : 3;
+    if (args.size() < positional || args.size() > positional + 1) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    const int runs = args.size() > positional ? std::atoi(args[positional].c_str()) : 20;
+    if (runs <= 0) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        std::vector<Result> results;
+        int status = EXIT_SUCCESS;
+        if (mode == "startup")
+            status = runStartup(readFile(args[1]), args[2], runs, results);
+        else if (mode == "faults")
+            status = runFaults(readFile(args[1]), args[2], runs, probability, results);
+        else
+            status = runParse(readFile(args[0]), runs, results);
+        if (!output.empty()) {
+            writeResults(output, mode, results);
+        }
+        return status;
+    } catch (const std::runtime_error& err) {
+        std::cout << "error: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
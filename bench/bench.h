@@ -0,0 +1,121 @@
+///
+/// @brief Entry points of the simplestream_bench modes.
+///
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Hardware counters reported per operation, when available.
+constexpr std::array<const char*, 4> COUNTER_NAMES = {
+    "cycles", "instructions", "cache-misses", "branch-misses"};
+
+///
+/// @brief Measurements of one benchmark.
+/// @details Each sample is the mean time per operation of one run, in
+/// nanoseconds. Per-operation counts that weren't measured are negative.
+///
+struct Result {
+    std::string name;
+    std::uint64_t ops = 0;
+    std::vector<double> samples;
+    double allocsPerOp = -1;
+    double bytesPerOp = -1;
+    std::array<double, COUNTER_NAMES.size()> countersPerOp = {-1, -1, -1, -1};
+
+    double mean() const {
+        double sum = 0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        return samples.empty() ? 0 : sum / static_cast<double>(samples.size());
+    }
+};
+
+///
+/// @brief One way of invoking the simplestream binary.
+///
+struct Scenario {
+    std::string name;
+    std::vector<std::string> args;
+};
+
+///
+/// @brief Wall time of one process from spawn to exit, and whether it exited
+/// successfully.
+///
+struct Launch {
+    std::chrono::nanoseconds elapsed{0};
+    bool ok = false;
+};
+
+///
+/// @brief Latency distribution of launches, in milliseconds. The samples are
+/// in nanoseconds.
+///
+struct Latency {
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double mean = 0;
+    double max = 0;
+    int runs = 0;
+    int failures = 0;
+    std::vector<double> samples;
+};
+
+///
+/// @brief Run `binary` with `args` to completion, discarding its output.
+///
+Launch launch(const std::string &binary, const std::vector<std::string> &args);
+
+///
+/// @brief Launch `binary` for `scenario` `runs` times after a warm-up run.
+/// @param timeFailures whether failed launches count towards the latency
+///
+Latency measure(const std::string &binary, const Scenario &scenario, int runs, bool timeFailures);
+
+void printLatencyHeader(const char *label);
+void printLatency(const std::string &name, const Latency &latency);
+
+///
+/// @brief Read a whole file, such as a saved Simplestream document.
+/// @throws std::runtime_error if the file can't be read
+///
+std::string readFile(const std::string &path);
+
+///
+/// @brief Measure process start to exit latency of the simplestream binary
+/// for common invocations, serving `document` from a local HTTP server.
+/// @return exit status
+///
+int runStartup(const std::string &document, const std::string &binary, int runs,
+               std::vector<Result> &results);
+
+///
+/// @brief Measure the latency and success rate of the simplestream binary
+/// against a local mock upstream that injects faults with `probability` per
+/// request, for each of a set of fault profiles.
+/// @return exit status
+///
+int runFaults(const std::string &document, const std::string &binary, int runs,
+              double probability, std::vector<Result> &results);
+
+///
+/// @brief Save `results` of the benchmark `mode` as JSON, along with metadata
+/// about the environment they were measured in.
+/// @throws std::runtime_error if the file can't be written
+///
+void writeResults(const std::string &path, const std::string &mode,
+                  const std::vector<Result> &results);
+
+///
+/// @brief Report the change in each benchmark from the `baseline` results
+/// document to the `candidate` one, with 95% confidence intervals.
+/// @return exit status
+///
+int runCompare(const std::string &baseline, const std::string &candidate);
@@ -0,0 +1,177 @@
+///
+/// @brief Tail latency of the simplestream binary against a degraded mirror.
+/// @details A local mock upstream serves the document while injecting faults
+/// with a configurable probability per request, and the binary is launched
+/// repeatedly against it under each fault profile.
+///
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <httplib.h>
+#include "bench.h"
+
+namespace {
+
+constexpr const char *DOCUMENT_PATH = "/streams/v1/download.json";
+// How long an injected stall or slow start lasts.
+constexpr auto FAULT_DELAY = std::chrono::milliseconds(500);
+// Number of consecutive 503 responses in a burst.
+constexpr int BURST_LENGTH = 5;
+// Size of the chunks the document is served in.
+constexpr std::size_t CHUNK_SIZE = 16 * 1024;
+
+///
+/// @brief Probability of each fault per request.
+///
+struct FaultProfile {
+    std::string name;
+    double slowStart = 0;
+    double stall = 0;
+    double reset = 0;
+    double truncate = 0;
+    double burst = 0;
+};
+
+///
+/// @brief Serves a document over HTTP, injecting the faults of a profile.
+/// @details A slow start delays the response headers, standing in for a slow
+/// TLS handshake since the mock serves plain HTTP. A stall pauses halfway
+/// through the body, a reset drops the connection there, and a truncation
+/// ends the chunked body there cleanly. A burst answers the request and the
+/// following ones with 503 Service Unavailable.
+///
+class MockUpstream {
+public:
+    MockUpstream(const std::string &document, std::uint32_t seed)
+        : m_document(document), m_random(seed) {
+        m_server.Get(DOCUMENT_PATH, [this](const httplib::Request&, httplib::Response &res) {
+            serve(res);
+        });
+    }
+
+    ~MockUpstream() {
+        m_server.stop();
+        if (m_listener.joinable())
+            m_listener.join();
+    }
+
+    /// @return the URL of the document, or an empty string on failure
+    std::string start() {
+        const int port = m_server.bind_to_any_port("127.0.0.1");
+        if (port < 0)
+            return {};
+        m_listener = std::thread([this] { m_server.listen_after_bind(); });
+        m_server.wait_until_ready();
+        return "http://127.0.0.1:" + std::to_string(port) + DOCUMENT_PATH;
+    }
+
+    void setProfile(const FaultProfile &profile) {
+        std::lock_guard lock(m_mutex);
+        m_profile = profile;
+        m_burstLeft = 0;
+    }
+
+private:
+    MockUpstream(const MockUpstream&) = delete;
+
+    enum class Fault { None, Stall, Reset, Truncate };
+
+    bool roll(double probability) {
+        return std::bernoulli_distribution(probability)(m_random);
+    }
+
+    void serve(httplib::Response &res) {
+        Fault fault = Fault::None;
+        bool slowStart = false;
+        {
+            std::lock_guard lock(m_mutex);
+            if (m_burstLeft > 0 || roll(m_profile.burst)) {
+                m_burstLeft = (m_burstLeft > 0 ? m_burstLeft : BURST_LENGTH) - 1;
+                res.status = 503;
+                return;
+            }
+            slowStart = roll(m_profile.slowStart);
+            if (roll(m_profile.stall))
+                fault = Fault::Stall;
+            else if (roll(m_profile.reset))
+                fault = Fault::Reset;
+            else if (roll(m_profile.truncate))
+                fault = Fault::Truncate;
+        }
+        if (slowStart)
+            std::this_thread::sleep_for(FAULT_DELAY);
+
+        const std::size_t half = m_document.size() / 2;
+        auto provider = [this, fault, half](std::size_t offset, httplib::DataSink &sink) {
+            if (offset >= m_document.size()) {
+                sink.done();
+                return true;
+            }
+            if (offset >= half && offset < half + CHUNK_SIZE) {
+                if (fault == Fault::Stall)
+                    std::this_thread::sleep_for(FAULT_DELAY);
+                if (fault == Fault::Reset)
+                    return false;
+                if (fault == Fault::Truncate) {
+                    sink.done();
+                    return true;
+                }
+            }
+            const std::size_t size = std::min(CHUNK_SIZE, m_document.size() - offset);
+            return sink.write(m_document.data() + offset, size);
+        };
+        res.set_chunked_content_provider("application/json", provider);
+    }
+
+    const std::string &m_document;
+    httplib::Server m_server;
+    std::thread m_listener;
+    std::mutex m_mutex;
+    std::mt19937 m_random;
+    FaultProfile m_profile;
+    int m_burstLeft = 0;
+};
+
+} // namespace
+
+int runFaults(const std::string &document, const std::string &binary, int runs,
+              double probability, std::vector<Result> &results)
+{
+    MockUpstream upstream(document, 0x5eed);
+    const std::string url = upstream.start();
+    if (url.empty()) {
+        std::cout << "error: Cannot start mock upstream" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const double p = probability;
+    const std::vector<FaultProfile> profiles = {
+        {"clean"},
+        {"slow start", p},
+        {"stall", 0, p},
+        {"reset", 0, 0, p},
+        {"truncate", 0, 0, 0, p},
+        {"5xx burst", 0, 0, 0, 0, p},
+        {"mixed", p / 5, p / 5, p / 5, p / 5, p / 5},
+    };
+
+    std::cout << "fault probability " << probability << " per request\n";
+    printLatencyHeader("profile");
+    const Scenario scenario = {"-s default", {"-s", "default", "-u", url, "--no-cache"}};
+    for (const auto &profile : profiles) {
+        upstream.setProfile(profile);
+        auto latency = measure(binary, scenario, runs, true);
+        printLatency(profile.name, latency);
+
+        Result result;
+        result.name = "faults: " + profile.name;
+        result.ops = latency.samples.size();
+        result.samples = std::move(latency.samples);
+        results.push_back(std::move(result));
+    }
+    return EXIT_SUCCESS;
+}
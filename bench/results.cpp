@@ -0,0 +1,242 @@
+///
+/// @brief Persistence and comparison of benchmark results.
+/// @details Results are saved as JSON with the samples of every benchmark and
+/// metadata about the machine and build, so that two runs (e.g. a pinned
+/// version and a new upstream one) can be compared with Welch's t-test.
+///
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <sys/utsname.h>
+#include <jsoncpp/json/json.h>
+#include "bench.h"
+
+namespace {
+
+/// Version of the results document layout.
+constexpr int RESULTS_FORMAT = 1;
+
+std::string cpuModel()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.starts_with("model name")) {
+            const auto colon = line.find(':');
+            if (colon != line.npos)
+                return line.substr(line.find_first_not_of(' ', colon + 1));
+        }
+    }
+    return "unknown";
+}
+
+Json::Value environment()
+{
+    Json::Value env;
+    utsname name{};
+    if (uname(&name) == 0) {
+        env["host"] = name.nodename;
+        env["kernel"] = std::string(name.sysname) + " " + name.release;
+        env["machine"] = name.machine;
+    }
+    env["cpu"] = cpuModel();
+    env["cpus"] = std::thread::hardware_concurrency();
+    env["compiler"] = __VERSION__;
+#ifdef NDEBUG
+    env["assertions"] = false;
+#else
+    env["assertions"] = true;
+#endif
+
+    const std::time_t now = std::time(nullptr);
+    char timestamp[32] = {};
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    env["timestamp"] = timestamp;
+    return env;
+}
+
+///
+/// @brief Summary statistics of a benchmark's samples.
+///
+struct Summary {
+    double mean = 0;
+    double variance = 0;
+    std::size_t count = 0;
+};
+
+Summary summarize(const Json::Value &samples)
+{
+    Summary ret;
+    ret.count = samples.size();
+    for (const auto &sample : samples) {
+        ret.mean += sample.asDouble();
+    }
+    if (ret.count == 0)
+        return ret;
+    ret.mean /= static_cast<double>(ret.count);
+    for (const auto &sample : samples) {
+        const double diff = sample.asDouble() - ret.mean;
+        ret.variance += diff * diff;
+    }
+    if (ret.count > 1)
+        ret.variance /= static_cast<double>(ret.count - 1);
+    return ret;
+}
+
+///
+/// @brief The 97.5th percentile of Student's t-distribution, for a two-sided
+/// 95% confidence interval.
+/// @details Below 30 degrees of freedom, where expansions around the normal
+/// quantile underestimate it badly, the exact quantile of the whole degrees
+/// of freedom below `df` is used, which errs on the side of a wider interval.
+/// From 30 on, the Cornish-Fisher expansion is accurate to a few parts in ten
+/// thousand.
+///
+double tQuantile975(double df)
+{
+    static constexpr double TABLE[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+    };
+    if (df < 30)
+        return TABLE[static_cast<std::size_t>(std::max(df, 1.0)) - 1];
+    constexpr double z = 1.959963984540054;
+    const double z3 = z * z * z;
+    const double z5 = z3 * z * z;
+    const double z7 = z5 * z * z;
+    return z + (z3 + z) / (4 * df)
+             + (5 * z5 + 16 * z3 + 3 * z) / (96 * df * df)
+             + (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * df * df * df);
+}
+
+Json::Value parseResults(const std::string &document)
+{
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(document, root))
+        throw std::runtime_error(reader.getFormattedErrorMessages());
+    if (!root.isObject() || root["format"].asInt() != RESULTS_FORMAT || !root["benchmarks"].isArray())
+        throw std::runtime_error("not a benchmark results document");
+    return root;
+}
+
+void printEnvironment(const char *label, const Json::Value &root)
+{
+    const auto &env = root["environment"];
+    std::cout << label << ": " << root["mode"].asString() << " on " << env["host"].asString()
+              << " (" << env["cpu"].asString() << ", " << env["kernel"].asString()
+              << ") at " << env["timestamp"].asString() << '\n';
+}
+
+} // namespace
+
+void writeResults(const std::string &path, const std::string &mode,
+                  const std::vector<Result> &results)
+{
+    Json::Value root;
+    root["format"] = RESULTS_FORMAT;
+    root["mode"] = mode;
+    root["environment"] = environment();
+    Json::Value &benchmarks = root["benchmarks"] = Json::arrayValue;
+    for (const auto &res : results) {
+        Json::Value bench;
+        bench["name"] = res.name;
+        bench["ops"] = static_cast<Json::UInt64>(res.ops);
+        bench["mean_ns"] = res.mean();
+        Json::Value &samples = bench["samples_ns"] = Json::arrayValue;
+        for (double sample : res.samples) {
+            samples.append(sample);
+        }
+        if (res.allocsPerOp >= 0) {
+            bench["allocs_per_op"] = res.allocsPerOp;
+            bench["bytes_per_op"] = res.bytesPerOp;
+        }
+        for (std::size_t i = 0; i < COUNTER_NAMES.size(); ++i) {
+            if (res.countersPerOp[i] >= 0)
+                bench["counters_per_op"][COUNTER_NAMES[i]] = res.countersPerOp[i];
+        }
+        benchmarks.append(bench);
+    }
+
+    std::ofstream file(path);
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "  ";
+    file << Json::writeString(writer, root) << '\n';
+    if (!file)
+        throw std::runtime_error("Cannot write " + path);
+}
+
+int runCompare(const std::string &baseline, const std::string &candidate)
+{
+    const Json::Value base = parseResults(baseline);
+    const Json::Value cand = parseResults(candidate);
+    printEnvironment("baseline", base);
+    printEnvironment("candidate", cand);
+    if (base["mode"] != cand["mode"])
+        std::cout << "warning: Comparing results of different benchmark modes\n";
+    std::cout << '\n';
+
+    std::map<std::string, const Json::Value*> candidates;
+    for (const auto &bench : cand["benchmarks"]) {
+        candidates[bench["name"].asString()] = &bench;
+    }
+
+    std::cout << std::left << std::setw(24) << "benchmark" << std::right
+              << std::setw(14) << "baseline ns" << std::setw(14) << "candidate ns"
+              << std::setw(10) << "delta" << std::setw(22) << "95% CI" << "  verdict\n";
+    std::cout << std::fixed;
+    for (const auto &bench : base["benchmarks"]) {
+        const std::string name = bench["name"].asString();
+        std::cout << std::left << std::setw(24) << name << std::right;
+        const auto found = candidates.find(name);
+        if (found == candidates.end()) {
+            std::cout << "  missing from candidate\n";
+            continue;
+        }
+        const Summary b = summarize(bench["samples_ns"]);
+        const Summary c = summarize((*found->second)["samples_ns"]);
+        candidates.erase(found);
+        std::cout << std::setprecision(1) << std::setw(14) << b.mean << std::setw(14) << c.mean;
+        if (b.count < 2 || c.count < 2 || b.mean <= 0) {
+            std::cout << std::setw(10) << "n/a" << std::setw(22) << "n/a" << "  too few samples\n";
+            continue;
+        }
+
+        // Welch's t-test: the confidence interval of the difference in means,
+        //  without assuming equal variances.
+        const double bErr = b.variance / static_cast<double>(b.count);
+        const double cErr = c.variance / static_cast<double>(c.count);
+        const double stdErr = std::sqrt(bErr + cErr);
+        const double diff = c.mean - b.mean;
+        double margin = 0;
+        if (stdErr > 0) {
+            const double df = (bErr + cErr) * (bErr + cErr) /
+                (bErr * bErr / static_cast<double>(b.count - 1) +
+                 cErr * cErr / static_cast<double>(c.count - 1));
+            margin = tQuantile975(df) * stdErr;
+        }
+        const double low = (diff - margin) / b.mean * 100;
+        const double high = (diff + margin) / b.mean * 100;
+
+        std::ostringstream delta, interval;
+        delta << std::fixed << std::setprecision(1) << std::showpos << diff / b.mean * 100 << '%';
+        interval << std::fixed << std::setprecision(1) << std::showpos
+                 << '[' << low << "%, " << high << "%]";
+        const char *verdict = low > 0 ? "slower" : high < 0 ? "faster" : "no change";
+        std::cout << std::setw(10) << delta.str() << std::setw(22) << interval.str()
+                  << "  " << verdict << '\n';
+    }
+    for (const auto &[name, bench] : candidates) {
+        std::cout << std::left << std::setw(24) << name << std::right << "  missing from baseline\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+///
+/// @brief End-to-end startup latency benchmark of the simplestream binary.
+/// @details Launches the binary repeatedly and measures the time from spawn
+/// to exit, which includes dynamic linking, OpenSSL and static initialization
+/// that the in-process benchmarks can't see.
+///
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <httplib.h>
+#include "bench.h"
+
+extern char **environ;
+
+namespace {
+
+constexpr const char *DOCUMENT_PATH = "/streams/v1/download.json";
+
+} // namespace
+
+Launch launch(const std::string &binary, const std::vector<std::string> &args)
+{
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(binary.c_str()));
+    for (const auto &arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    const auto start = std::chrono::steady_clock::now();
+    pid_t pid = 0;
+    int status = 0;
+    const int err = posix_spawn(&pid, binary.c_str(), &actions, nullptr, argv.data(), environ);
+    if (err == 0)
+        waitpid(pid, &status, 0);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    posix_spawn_file_actions_destroy(&actions);
+
+    Launch ret;
+    ret.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    ret.ok = err == 0 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    return ret;
+}
+
+Latency measure(const std::string &binary, const Scenario &scenario, int runs, bool timeFailures)
+{
+    Latency ret;
+    ret.runs = runs;
+    auto &samples = ret.samples;
+    launch(binary, scenario.args); // Warm up the page cache.
+    for (int i = 0; i < runs; ++i) {
+        const auto run = launch(binary, scenario.args);
+        if (!run.ok)
+            ++ret.failures;
+        if (run.ok || timeFailures)
+            samples.push_back(std::chrono::duration<double, std::nano>(run.elapsed).count());
+    }
+    if (samples.empty())
+        return ret;
+
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+        const auto index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[index] / 1e6;
+    };
+    ret.p50 = percentile(0.50);
+    ret.p90 = percentile(0.90);
+    ret.p99 = percentile(0.99);
+    ret.max = sorted.back() / 1e6;
+    for (double sample : sorted) {
+        ret.mean += sample;
+    }
+    ret.mean /= static_cast<double>(sorted.size()) * 1e6;
+    return ret;
+}
+
+void printLatencyHeader(const char *label)
+{
+    std::cout << std::left << std::setw(24) << label << std::right
+              << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "mean ms"
+              << std::setw(10) << "max ms" << std::setw(10) << "success" << '\n';
+}
+
+void printLatency(const std::string &name, const Latency &latency)
+{
+    std::cout << std::fixed << std::setprecision(2)
+              << std::left << std::setw(24) << name << std::right
+              << std::setw(10) << latency.p50 << std::setw(10) << latency.p90
+              << std::setw(10) << latency.p99 << std::setw(10) << latency.mean
+              << std::setw(10) << latency.max << std::setw(9)
+              << 100.0 * (latency.runs - latency.failures) / std::max(latency.runs, 1) << "%\n";
+}
+
+int runStartup(const std::string &document, const std::string &binary, int runs,
+               std::vector<Result> &results)
+{
+    // Serve the document locally so that network latency doesn't drown out
+    //  the startup costs being measured.
+    httplib::Server server;
+    server.Get(DOCUMENT_PATH, [&](const httplib::Request&, httplib::Response &res) {
+        res.set_content(document, "application/json");
+    });
+    const int port = server.bind_to_any_port("127.0.0.1");
+    if (port < 0) {
+        std::cout << "error: Cannot start local server" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::thread listener([&] { server.listen_after_bind(); });
+    server.wait_until_ready();
+    const std::string url = "http://127.0.0.1:" + std::to_string(port) + DOCUMENT_PATH;
+
+    // Record a cassette of the fetch to measure offline replay, which
+    //  touches neither the network nor TLS.
+    const auto cassette = std::filesystem::temp_directory_path() /
+        ("simplestream_bench_" + std::to_string(getpid()) + ".cassette");
+    if (!launch(binary, {"-c", "-u", url, "--record", cassette}).ok) {
+        std::cout << "error: Cannot record a cassette with " << binary << std::endl;
+        server.stop();
+        listener.join();
+        return EXIT_FAILURE;
+    }
+
+    // Fetches bypass the cache unless a scenario measures it, in a private
+    //  directory that the cache scenario's warm-up run fills.
+    const auto cacheDir = std::filesystem::temp_directory_path() /
+        ("simplestream_bench_" + std::to_string(getpid()) + ".cache");
+    const std::vector<Scenario> scenarios = {
+        {"--help", {"--help"}},
+        {"-c", {"-c", "-u", url, "--no-cache"}},
+        {"-s default", {"-s", "default", "-u", url, "--no-cache"}},
+        {"-l", {"-l", "-u", url, "--no-cache"}},
+        {"-s default (replay)", {"-s", "default", "-u", url, "--replay", cassette, "--replay-scale", "0"}},
+        {"-s default (cached)", {"-s", "default", "-u", url, "--cache-dir", cacheDir}},
+    };
+
+    printLatencyHeader("scenario");
+    int status = EXIT_SUCCESS;
+    for (const auto &scenario : scenarios) {
+        auto latency = measure(binary, scenario, runs, false);
+        printLatency(scenario.name, latency);
+        if (latency.failures)
+            status = EXIT_FAILURE;
+
+        Result result;
+        result.name = scenario.name;
+        result.ops = latency.samples.size();
+        result.samples = std::move(latency.samples);
+        results.push_back(std::move(result));
+    }
+
+    std::filesystem::remove(cassette);
+    std::filesystem::remove_all(cacheDir);
+    server.stop();
+    listener.join();
+    return status;
+}
@@ -0,0 +1,492 @@
+///
+/// @brief On-disk cache of fetched Simplestream documents.
+///
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <jsoncpp/json/json.h>
+
+// How long a fetched document is used before it is revalidated, unless the
+//  server says otherwise.
+constexpr std::chrono::seconds CACHE_TTL = std::chrono::hours(1);
+// How long a refresh may take before its lease is presumed abandoned.
+constexpr std::chrono::seconds LEASE_DURATION = std::chrono::minutes(2);
+
+///
+/// @brief A cached document's validators and expiry. The body is read
+/// separately with DocumentCache::readBody().
+///
+struct CacheEntry {
+    std::chrono::system_clock::time_point expires;
+    std::string etag;
+    std::string lastModified;
+
+    bool fresh() const { return std::chrono::system_clock::now() < expires; }
+};
+
+///
+/// @brief Decides whether and until when a fetched document is cached.
+/// @details The server's freshness lifetime, from Cache-Control max-age or
+/// else Expires, less the Age the response already spent in caches, is used
+/// when given, and CACHE_TTL otherwise. An Expires that can't be parsed
+/// means already expired. The lifetime is bounded to [minTtl, maxTtl], then
+/// shortened by a random fraction of up to `jitter` of its excess over
+/// minTtl, so that hosts that fetched at the same time don't all revalidate
+/// at the same time again, even when a bound applies.
+/// A response with Cache-Control no-store isn't cached at all.
+///
+struct CachePolicy {
+    std::chrono::seconds minTtl{0};
+    std::chrono::seconds maxTtl = std::chrono::hours(24);
+    double jitter = 0.1;
+
+    /// @return when a document fetched now with the given response headers
+    /// (empty if absent) expires
+    std::chrono::system_clock::time_point expiry(const std::string &cacheControl,
+                                                 const std::string &expires,
+                                                 const std::string &date,
+                                                 const std::string &age = {}) const {
+        const auto now = std::chrono::system_clock::now();
+        auto ttl = lifetime(cacheControl, expires, date, now).value_or(CACHE_TTL);
+        ttl = std::max(ttl - parseSeconds(age).value_or(std::chrono::seconds(0)), std::chrono::seconds(0));
+        ttl = std::clamp(ttl, minTtl, maxTtl);
+        if (jitter > 0) {
+            std::random_device random;
+            std::uniform_real_distribution<double> fraction(0, std::min(jitter, 1.0));
+            ttl -= std::chrono::duration_cast<std::chrono::seconds>((ttl - minTtl) * fraction(random));
+        }
+        return now + ttl;
+    }
+
+    /// @return whether a response with the given Cache-Control header may be
+    /// stored
+    static bool storable(const std::string &cacheControl) {
+        const auto found = directives(cacheControl);
+        return std::find(found.begin(), found.end(), "no-store") == found.end();
+    }
+
+private:
+    /// @return the directives of a Cache-Control header, in lowercase
+    static std::vector<std::string> directives(const std::string &cacheControl) {
+        std::vector<std::string> ret;
+        std::istringstream list(cacheControl);
+        std::string directive;
+        while (std::getline(list, directive, ',')) {
+            directive.erase(0, directive.find_first_not_of(" \t"));
+            directive.erase(directive.find_last_not_of(" \t") + 1);
+            std::transform(directive.begin(), directive.end(), directive.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+            ret.push_back(std::move(directive));
+        }
+        return ret;
+    }
+
+    /// @return the freshness lifetime the server gave, if any
+    static std::optional<std::chrono::seconds> lifetime(const std::string &cacheControl,
+                                                        const std::string &expires,
+                                                        const std::string &date,
+                                                        std::chrono::system_clock::time_point now) {
+        std::optional<std::chrono::seconds> maxAge;
+        for (const auto &directive : directives(cacheControl)) {
+            if (directive == "no-cache" || directive == "no-store")
+                return std::chrono::seconds(0);
+            // An invalid max-age means already expired, like an invalid
+            //  Expires.
+            if (directive.starts_with("max-age="))
+                maxAge = parseSeconds(directive.substr(8)).value_or(std::chrono::seconds(0));
+        }
+        if (maxAge)
+            return maxAge;
+        if (expires.empty())
+            return std::nullopt;
+
+        // Expires is relative to the server's clock, as given by Date. An
+        //  invalid date, such as "0", means already expired (RFC 9111
+        //  section 5.3).
+        const auto expiresAt = parseHttpDate(expires);
+        if (!expiresAt)
+            return std::chrono::seconds(0);
+        const auto serverNow = parseHttpDate(date).value_or(now);
+        return std::max(std::chrono::duration_cast<std::chrono::seconds>(*expiresAt - serverNow),
+                        std::chrono::seconds(0));
+    }
+
+    /// @return the non-negative number of seconds in `text`, if that's all it
+    /// holds
+    static std::optional<std::chrono::seconds> parseSeconds(const std::string &text) {
+        long long seconds = 0;
+        const char *last = text.data() + text.size();
+        const auto [parsed, err] = std::from_chars(text.data(), last, seconds);
+        if (err != std::errc() || parsed != last || seconds < 0)
+            return std::nullopt;
+        return std::chrono::seconds(seconds);
+    }
+
+    /// @return the time of an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+    static std::optional<std::chrono::system_clock::time_point> parseHttpDate(const std::string &text) {
+        std::tm tm {};
+        const char *end = strptime(text.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (!end || *end)
+            return std::nullopt;
+        return std::chrono::system_clock::from_time_t(timegm(&tm));
+    }
+};
+
+///
+/// @brief Identifies a file and the state of its content. If any field
+/// changed, the content may have changed.
+///
+struct FileStamp {
+    std::uint64_t device = 0;
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::int64_t mtimeNs = 0;
+    std::int64_t ctimeNs = 0;
+
+    /// @return the stamp of the open file `fd`, if it can be stat'ed
+    static std::optional<FileStamp> of(int fd) {
+        struct stat st {};
+        if (fstat(fd, &st) != 0)
+            return std::nullopt;
+        FileStamp ret;
+        ret.device = st.st_dev;
+        ret.inode = st.st_ino;
+        ret.size = static_cast<std::uint64_t>(st.st_size);
+        ret.mtimeNs = st.st_mtim.tv_sec * 1'000'000'000LL + st.st_mtim.tv_nsec;
+        ret.ctimeNs = st.st_ctim.tv_sec * 1'000'000'000LL + st.st_ctim.tv_nsec;
+        return ret;
+    }
+
+    bool operator==(const FileStamp&) const = default;
+};
+
+///
+/// @brief The digests of a local file when it had `stamp`. The tree hash is
+/// only recorded once the SHA-256 digest matched a stream checksum.
+///
+struct DigestRecord {
+    FileStamp stamp;
+    std::string sha256;
+    std::string treeHash;
+};
+
+///
+/// @brief Stores documents by URL in a directory, each as a body file and a
+/// small JSON metadata file. Also stores signature verification results by
+/// document digest, and digests of local files by FileStamp.
+/// @details Files are written to a temporary name and renamed into place, so
+/// readers never see a partial file. Failing to read or write the cache is
+/// never an error: the document is simply fetched again.
+///
+class DocumentCache {
+public:
+    explicit DocumentCache(std::filesystem::path dir) : m_dir(std::move(dir)) {}
+
+    /// @return $XDG_CACHE_HOME/simplestream, or ~/.cache/simplestream
+    static std::filesystem::path defaultDirectory() {
+        if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+            return std::filesystem::path(xdg) / "simplestream";
+        if (const char *home = std::getenv("HOME"); home && *home)
+            return std::filesystem::path(home) / ".cache" / "simplestream";
+        return std::filesystem::temp_directory_path() / "simplestream";
+    }
+
+    /// @return the metadata of the cached document for `url`, if any
+    std::optional<CacheEntry> lookup(const std::string &url) const {
+        std::ifstream file(pathFor(url, ".meta"));
+        Json::Value meta;
+        Json::Reader reader;
+        // Anything but the object storeEntry() writes is ignored, rather than
+        //  letting jsoncpp throw on the wrong types.
+        if (!file || !reader.parse(file, meta) || !meta.isObject() || !meta["url"].isString() ||
+            meta["url"].asString() != url || !meta["expires"].isInt64() || !meta["etag"].isString() ||
+            !meta["last_modified"].isString())
+            return std::nullopt;
+        CacheEntry ret;
+        ret.expires = std::chrono::system_clock::time_point(std::chrono::seconds(meta["expires"].asInt64()));
+        ret.etag = meta["etag"].asString();
+        ret.lastModified = meta["last_modified"].asString();
+        return ret;
+    }
+
+    /// @return the body of the cached document for `url`, if any
+    std::optional<std::string> readBody(const std::string &url) const {
+        return readFile(pathFor(url, ".json"));
+    }
+
+    /// Cache `body` as the document for `url`.
+    /// @return whether the document was cached
+    bool store(const std::string &url, const CacheEntry &entry, const std::string &body) const {
+        return writeFile(pathFor(url, ".json"), body) && storeEntry(url, entry);
+    }
+
+    /// Update the metadata of the cached document for `url`, e.g. after the
+    /// server confirmed it is unchanged.
+    /// @return whether the metadata was cached
+    bool storeEntry(const std::string &url, const CacheEntry &entry) const {
+        Json::Value meta;
+        meta["url"] = url;
+        meta["expires"] = static_cast<Json::Int64>(std::chrono::duration_cast<std::chrono::seconds>(
+            entry.expires.time_since_epoch()).count());
+        meta["etag"] = entry.etag;
+        meta["last_modified"] = entry.lastModified;
+        Json::StreamWriterBuilder writer;
+        return writeFile(pathFor(url, ".meta"), Json::writeString(writer, meta));
+    }
+
+    /// @return whether a document with the SHA-256 `digest` was verified
+    /// against the keyring with the SHA-256 `keyringDigest` before. Only
+    /// records written by the current user count, so that another user who
+    /// can write the cache directory can't forge them.
+    bool verified(const std::string &digest, const std::string &keyringDigest) const {
+        const int fd = open(verifiedPath(digest, keyringDigest).c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0)
+            return false;
+        struct stat st {};
+        char record[256] = {};
+        const bool owned = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid() &&
+            !(st.st_mode & (S_IWGRP | S_IWOTH));
+        const ssize_t got = owned ? read(fd, record, sizeof(record) - 1) : -1;
+        close(fd);
+        // The record names both digests, so a copy or link of another
+        //  record doesn't match.
+        return got > 0 && std::string(record, static_cast<std::size_t>(got)) == digest + '\n' + keyringDigest + '\n';
+    }
+
+    /// Record that the document with the SHA-256 `digest` has a good
+    /// signature by a key in the keyring with the SHA-256 `keyringDigest`.
+    /// @return whether the result was cached
+    bool storeVerified(const std::string &digest, const std::string &keyringDigest) const {
+        return writeFile(verifiedPath(digest, keyringDigest), digest + '\n' + keyringDigest + '\n');
+    }
+
+    /// @return the digests recorded for the file with the device and inode
+    /// of `stamp`, whose stamp may since have changed
+    std::optional<DigestRecord> lookupDigest(const FileStamp &stamp) const {
+        std::ifstream file(pathFor(stampKey(stamp), ".digest"));
+        Json::Value record;
+        Json::Reader reader;
+        if (!file || !reader.parse(file, record) || !record.isObject() || !record["sha256"].isString() ||
+            !record["device"].isUInt64() || !record["inode"].isUInt64() || !record["size"].isUInt64() ||
+            !record["mtime_ns"].isInt64() || !record["ctime_ns"].isInt64() ||
+            !(record["tree_hash"].isNull() || record["tree_hash"].isString()))
+            return std::nullopt;
+        DigestRecord ret;
+        ret.stamp.device = record["device"].asUInt64();
+        ret.stamp.inode = record["inode"].asUInt64();
+        ret.stamp.size = record["size"].asUInt64();
+        ret.stamp.mtimeNs = record["mtime_ns"].asInt64();
+        ret.stamp.ctimeNs = record["ctime_ns"].asInt64();
+        ret.sha256 = record["sha256"].asString();
+        ret.treeHash = record["tree_hash"].asString();
+        if (ret.stamp.device != stamp.device || ret.stamp.inode != stamp.inode)
+            return std::nullopt;
+        return ret;
+    }
+
+    /// Record the digests of a file.
+    /// @return whether the digests were cached
+    bool storeDigest(const DigestRecord &digest) const {
+        Json::Value record;
+        record["device"] = static_cast<Json::UInt64>(digest.stamp.device);
+        record["inode"] = static_cast<Json::UInt64>(digest.stamp.inode);
+        record["size"] = static_cast<Json::UInt64>(digest.stamp.size);
+        record["mtime_ns"] = static_cast<Json::Int64>(digest.stamp.mtimeNs);
+        record["ctime_ns"] = static_cast<Json::Int64>(digest.stamp.ctimeNs);
+        record["sha256"] = digest.sha256;
+        if (!digest.treeHash.empty())
+            record["tree_hash"] = digest.treeHash;
+        Json::StreamWriterBuilder writer;
+        return writeFile(pathFor(stampKey(digest.stamp), ".digest"), Json::writeString(writer, record));
+    }
+
+    ///
+    /// @brief Try to become the one process that refreshes the document for
+    /// `url`, when several share the cache directory, e.g. over NFS.
+    /// @details The lease is a file created with link(), which is atomic even
+    /// on NFS, and expires after LEASE_DURATION so that a crashed holder
+    /// doesn't block refreshes for good. Two processes taking over the same
+    /// expired lease at once may both succeed, which only costs a redundant
+    /// refresh. If no lease file can be created at all, e.g. in a read-only
+    /// directory, the lease is granted: refreshing uncoordinated beats not
+    /// refreshing.
+    /// @param holder identifies the caller in the lease
+    /// @return whether the caller holds the lease
+    ///
+    bool acquireLease(const std::string &url, const std::string &holder) const {
+        const auto path = pathFor(url, ".lease");
+        Json::Value lease;
+        lease["holder"] = holder;
+        lease["expires"] = static_cast<Json::Int64>(std::chrono::duration_cast<std::chrono::seconds>(
+            (std::chrono::system_clock::now() + LEASE_DURATION).time_since_epoch()).count());
+        Json::StreamWriterBuilder writer;
+        const auto temp = writeTemp(path, Json::writeString(writer, lease));
+        if (!temp)
+            return true;
+        bool held = false;
+        for (int attempt = 0; attempt < 2 && !held; ++attempt) {
+            if (link(temp->c_str(), path.c_str()) == 0) {
+                held = true;
+            } else if (errno != EEXIST) {
+                held = true;
+                break;
+            } else if (leaseValid(path)) {
+                break;
+            } else {
+                // The holder presumably crashed, so take over.
+                unlink(path.c_str());
+            }
+        }
+        unlink(temp->c_str());
+        return held;
+    }
+
+    /// Give up the lease for `url`, if `holder` still holds it.
+    void releaseLease(const std::string &url, const std::string &holder) const {
+        const auto path = pathFor(url, ".lease");
+        std::ifstream file(path);
+        Json::Value lease;
+        Json::Reader reader;
+        if (file && reader.parse(file, lease) && lease.isObject() && lease["holder"].isString() &&
+            lease["holder"].asString() == holder)
+            unlink(path.c_str());
+    }
+
+private:
+    static std::optional<std::string> readFile(const std::filesystem::path &path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return std::nullopt;
+        std::string ret(static_cast<std::size_t>(file.tellg()), '\0');
+        file.seekg(0);
+        if (!file.read(ret.data(), static_cast<std::streamsize>(ret.size())))
+            return std::nullopt;
+        return ret;
+    }
+
+    bool leaseValid(const std::filesystem::path &path) const {
+        std::ifstream file(path);
+        Json::Value lease;
+        Json::Reader reader;
+        if (!file || !reader.parse(file, lease) || !lease.isObject() || !lease["expires"].isInt64()) {
+            // Possibly still being written, so only presume it abandoned once
+            //  it's older than a lease.
+            std::error_code err;
+            const auto modified = std::filesystem::last_write_time(path, err);
+            return !err && std::filesystem::file_time_type::clock::now() - modified < LEASE_DURATION;
+        }
+        const std::chrono::system_clock::time_point expires(std::chrono::seconds(lease["expires"].asInt64()));
+        return std::chrono::system_clock::now() < expires;
+    }
+
+    /// Verification results are keyed by the document and the keyring's
+    /// content, so that changing the keys in the keyring, e.g. revoking one,
+    /// or using another keyring invalidates them.
+    std::filesystem::path verifiedPath(const std::string &digest, const std::string &keyringDigest) const {
+        return m_dir / (digest + "-" + keyringDigest + ".verified");
+    }
+
+    /// Records of a file are keyed by its device and inode, so that they
+    /// follow the file when it is renamed.
+    static std::string stampKey(const FileStamp &stamp) {
+        return "file:" + std::to_string(stamp.device) + ":" + std::to_string(stamp.inode);
+    }
+
+    /// Cache files are named by a 64-bit FNV-1a hash of the URL, which the
+    /// metadata records to detect collisions.
+    std::filesystem::path pathFor(const std::string &url, const char *extension) const {
+        std::uint64_t hash = 0xcbf29ce484222325;
+        for (unsigned char c : url) {
+            hash = (hash ^ c) * 0x100000001b3;
+        }
+        std::ostringstream name;
+        name << std::hex << hash << extension;
+        return m_dir / name.str();
+    }
+
+    /// Write `data` to a temporary file next to `path`, named uniquely even
+    /// among hosts sharing the directory, and writable only by its owner.
+    /// @return the temporary file, or nothing if it couldn't be written
+    std::optional<std::string> writeTemp(const std::filesystem::path &path, const std::string &data) const {
+        std::error_code err;
+        std::filesystem::create_directories(m_dir, err);
+        char host[256] = {};
+        gethostname(host, sizeof(host) - 1);
+        const auto temp = path.string() + ".tmp." + host + "." + std::to_string(getpid());
+        bool written = false;
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            written = file && file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+        // Only the owner may change a cache file, whatever the umask, which
+        //  verified() relies on.
+        if (!written || chmod(temp.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) != 0) {
+            std::filesystem::remove(temp, err);
+            return std::nullopt;
+        }
+        return temp;
+    }
+
+    bool writeFile(const std::filesystem::path &path, const std::string &data) const {
+        const auto temp = writeTemp(path, data);
+        if (!temp)
+            return false;
+        std::error_code err;
+        std::filesystem::rename(*temp, path, err);
+        if (err) {
+            std::filesystem::remove(*temp, err);
+            return false;
+        }
+        return true;
+    }
+
+    std::filesystem::path m_dir;
+};
+
+///
+/// @brief Holds the refresh lease of a document for as long as it's in scope.
+///
+class RefreshLease {
+public:
+    RefreshLease(const DocumentCache &cache, std::string url)
+        : m_cache(cache), m_url(std::move(url)) {
+        char host[256] = {};
+        gethostname(host, sizeof(host) - 1);
+        m_holder = std::string(host) + ":" + std::to_string(getpid());
+        m_held = m_cache.acquireLease(m_url, m_holder);
+    }
+
+    ~RefreshLease() {
+        if (m_held)
+            m_cache.releaseLease(m_url, m_holder);
+    }
+
+    bool held() const { return m_held; }
+
+private:
+    RefreshLease(const RefreshLease&) = delete;
+
+    const DocumentCache &m_cache;
+    std::string m_url;
+    std::string m_holder;
+    bool m_held = false;
+};
@@ -0,0 +1,198 @@
+///
+/// @brief SHA-256 digests of local files, such as downloaded images.
+///
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cache.h"
+#include "sha256.h"
+
+// Size of the reads when hashing a file.
+constexpr std::size_t HASH_BLOCK_SIZE = 1 << 20;
+// Size of the leaves of a tree hash, each hashed independently.
+constexpr std::size_t TREE_CHUNK_SIZE = 4 << 20;
+
+///
+/// @brief Computes the SHA-256 digest of files, reusing a digest from the
+/// cache while the file's stamp is unchanged.
+/// @details A change to the content changes the size or mtime. The ctime
+/// also catches content rewritten with its mtime restored, and the inode a
+/// file replaced by another. Digests are cached in the DocumentCache rather
+/// than in extended attributes: storing an attribute would itself change the
+/// ctime, and read-only images couldn't be stamped at all.
+///
+/// Once a file matched a stream checksum, seal() records a tree hash of it
+/// as well: the SHA-256 of the SHA-256 digests of its chunks, which can be
+/// computed on all cores. When the stamp of a sealed file changes, e.g. when
+/// it was renamed or touched, an unchanged tree hash confirms the recorded
+/// SHA-256 digest without the serial pass over the whole file. The stream
+/// checksum remains the root of trust; the tree hash only ever vouches for
+/// content whose SHA-256 digest was computed before.
+///
+class FileDigest {
+public:
+    /// @param cache the cache to reuse digests from, or nullptr
+    explicit FileDigest(const DocumentCache *cache) : m_cache(cache) {}
+
+    /// @return the lowercase hex SHA-256 digest of the file at `path`
+    /// @throws std::runtime_error if the file can't be read
+    std::string sha256(const std::string &path) const {
+        return withFile(path, [&](int fd, const FileStamp &stamp) {
+            const auto record = m_cache ? m_cache->lookupDigest(stamp) : std::nullopt;
+            if (record && record->stamp == stamp)
+                return record->sha256;
+            if (record && !record->treeHash.empty() && record->stamp.size == stamp.size &&
+                treeHash(fd, stamp.size, path) == record->treeHash) {
+                store(fd, {stamp, record->sha256, record->treeHash});
+                return record->sha256;
+            }
+            std::string ret = serialHash(fd, path);
+            store(fd, {stamp, ret, {}});
+            return ret;
+        });
+    }
+
+    /// Record the tree hash of the file at `path`, whose SHA-256 `digest`
+    /// matched a stream checksum, unless it's recorded already. Only a file
+    /// whose SHA-256 digest is recorded as `digest` for its current stamp is
+    /// sealed, so that content changed since the digest was computed isn't.
+    /// @return whether a tree hash was computed
+    /// @throws std::runtime_error if the file can't be read
+    bool seal(const std::string &path, const std::string &digest) const {
+        if (!m_cache)
+            return false;
+        return withFile(path, [&](int fd, const FileStamp &stamp) {
+            const auto record = m_cache->lookupDigest(stamp);
+            if (!record || record->stamp != stamp || record->sha256 != digest || !record->treeHash.empty())
+                return false;
+            const std::string tree = treeHash(fd, stamp.size, path);
+            // store() drops the record if the file changed while hashing.
+            store(fd, {stamp, digest, tree});
+            return true;
+        });
+    }
+
+    /// Record the SHA-256 `digest` of the file at `path`, computed while it
+    /// was written, so that checking it doesn't read it again.
+    void remember(const std::string &path, const std::string &digest) const {
+        if (!m_cache)
+            return;
+        withFile(path, [&](int fd, const FileStamp &stamp) { store(fd, {stamp, digest, {}}); });
+    }
+
+private:
+    /// Run `body` with the file at `path` open and its stamp.
+    template<typename F>
+    static std::invoke_result_t<F, int, const FileStamp&> withFile(const std::string &path, F &&body) {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + path);
+        try {
+            const auto stamp = FileStamp::of(fd);
+            if (!stamp)
+                throw std::runtime_error("Cannot stat " + path);
+            if constexpr (std::is_void_v<std::invoke_result_t<F, int, const FileStamp&>>) {
+                body(fd, *stamp);
+                close(fd);
+            } else {
+                auto ret = body(fd, *stamp);
+                close(fd);
+                return ret;
+            }
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    /// Cache `record`, unless the file changed since its stamp was taken.
+    void store(int fd, const DigestRecord &record) const {
+        if (m_cache && FileStamp::of(fd) == record.stamp)
+            m_cache->storeDigest(record);
+    }
+
+    static std::string serialHash(int fd, const std::string &path) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        Sha256 hasher;
+        std::vector<char> block(HASH_BLOCK_SIZE);
+        ssize_t got = 0;
+        while ((got = read(fd, block.data(), block.size())) != 0) {
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                throw std::runtime_error("Cannot read " + path);
+            hasher.update(block.data(), static_cast<std::size_t>(got));
+        }
+        return Sha256::toHex(hasher.final());
+    }
+
+    ///
+    /// @brief Hash the chunks of a file on all cores, then hash their digests
+    /// and the file size into the root.
+    /// @throws std::runtime_error if the file can't be read
+    ///
+    static std::string treeHash(int fd, std::uint64_t size, const std::string &path) {
+        const std::size_t chunks = static_cast<std::size_t>((size + TREE_CHUNK_SIZE - 1) / TREE_CHUNK_SIZE);
+        std::vector<std::string> leaves(chunks);
+        std::atomic<std::size_t> next = 0;
+        std::atomic<bool> failed = false;
+        auto worker = [&] {
+            std::vector<char> chunk(TREE_CHUNK_SIZE);
+            while (!failed) {
+                const std::size_t i = next++;
+                if (i >= chunks)
+                    break;
+                const std::uint64_t offset = std::uint64_t(i) * TREE_CHUNK_SIZE;
+                const auto length = static_cast<std::size_t>(std::min<std::uint64_t>(TREE_CHUNK_SIZE, size - offset));
+                std::size_t done = 0;
+                while (done < length) {
+                    const ssize_t got = pread(fd, chunk.data() + done, length - done,
+                                              static_cast<off_t>(offset + done));
+                    if (got < 0 && errno == EINTR)
+                        continue;
+                    if (got <= 0) {
+                        failed = true;
+                        return;
+                    }
+                    done += static_cast<std::size_t>(got);
+                }
+                try {
+                    Sha256 hasher;
+                    hasher.update(chunk.data(), length);
+                    leaves[i] = hasher.final();
+                } catch (const std::runtime_error&) {
+                    failed = true;
+                }
+            }
+        };
+        const std::size_t threads = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), chunks);
+        std::vector<std::jthread> pool;
+        for (std::size_t i = 1; i < threads; ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        pool.clear();
+        if (failed)
+            throw std::runtime_error("Cannot hash " + path);
+
+        Sha256 root;
+        for (const auto &leaf : leaves) {
+            root.update(leaf.data(), leaf.size());
+        }
+        root.update(&size, sizeof(size));
+        return Sha256::toHex(root.final());
+    }
+
+    const DocumentCache *m_cache;
+};
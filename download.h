@@ -0,0 +1,155 @@
+///
+/// @brief Writing downloaded images to disk.
+///
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "digest.h"
+
+// Size of the blocks that are checked for zeroes, a multiple of the file
+//  system block size.
+constexpr std::size_t SPARSE_BLOCK_SIZE = 64 * 1024;
+
+///
+/// @brief Writes an image as it arrives, hashing every byte but leaving holes
+/// where whole blocks are zero.
+/// @details Cloud disk images have large zeroed regions. Zero blocks are
+/// skipped rather than written, and when the image size is known up front
+/// the file is preallocated with fallocate() so that the data is laid out
+/// contiguously, and the preallocated space of zero runs is released by
+/// punching holes. The image is written to `path` with ".part" appended and
+/// only renamed to `path` by commit().
+///
+class ImageWriter {
+public:
+    /// @param size the expected size of the image, or 0 if unknown
+    /// @throws std::runtime_error if the file can't be created
+    ImageWriter(std::string path, std::uint64_t size)
+        : m_path(std::move(path)), m_partPath(m_path + ".part") {
+        m_fd = open(m_partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+            throw std::runtime_error("Cannot create " + m_partPath + ": " + std::strerror(errno));
+        // Preallocation is only an optimization, e.g. unsupported on tmpfs.
+        if (size > 0)
+            m_preallocated = fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) == 0;
+        m_block.reserve(SPARSE_BLOCK_SIZE);
+    }
+
+    ~ImageWriter() {
+        if (m_fd >= 0) {
+            close(m_fd);
+            unlink(m_partPath.c_str());
+        }
+    }
+
+    /// Append data to the image.
+    /// @throws std::runtime_error if the data can't be written
+    void write(const char *data, std::size_t size) {
+        while (size > 0) {
+            const std::size_t take = std::min(size, SPARSE_BLOCK_SIZE - m_block.size());
+            // Whole blocks go straight from the receive buffer.
+            if (m_block.empty() && take == SPARSE_BLOCK_SIZE) {
+                writeBlock(data, take);
+            } else {
+                m_block.insert(m_block.end(), data, data + take);
+                if (m_block.size() == SPARSE_BLOCK_SIZE) {
+                    writeBlock(m_block.data(), m_block.size());
+                    m_block.clear();
+                }
+            }
+            data += take;
+            size -= take;
+        }
+    }
+
+    /// Finish writing the image, and rename it into place if its digest is
+    /// `expected`.
+    /// @return the lowercase hex SHA-256 digest of the image
+    /// @throws std::runtime_error if the image couldn't be written or has a
+    /// different digest
+    std::string commit(const std::string &expected) {
+        if (!m_block.empty()) {
+            writeBlock(m_block.data(), m_block.size());
+            m_block.clear();
+        }
+        // Trailing zero blocks were never written, so extend the file over
+        //  them.
+        if (ftruncate(m_fd, static_cast<off_t>(m_offset)) != 0)
+            throw std::runtime_error("Cannot write " + m_partPath + ": " + std::strerror(errno));
+        endZeroRun();
+        const std::string digest = Sha256::toHex(m_hash.final());
+        if (digest != expected)
+            throw std::runtime_error("Checksum mismatch for " + m_path);
+        if (close(std::exchange(m_fd, -1)) != 0 || rename(m_partPath.c_str(), m_path.c_str()) != 0) {
+            unlink(m_partPath.c_str());
+            throw std::runtime_error("Cannot write " + m_path + ": " + std::strerror(errno));
+        }
+        return digest;
+    }
+
+private:
+    ImageWriter(const ImageWriter&) = delete;
+
+    /// @return whether all `size` bytes at `data` are zero
+    static bool isZero(const char *data, std::size_t size) {
+        // Comparing the block with itself shifted by one byte lets memcmp's
+        //  vectorized loop do the scan.
+        return size == 0 || (data[0] == 0 && std::memcmp(data, data + 1, size - 1) == 0);
+    }
+
+    void writeBlock(const char *data, std::size_t size) {
+        m_hash.update(data, size);
+        if (isZero(data, size)) {
+            if (!m_inZeroRun) {
+                m_inZeroRun = true;
+                m_zeroRunStart = m_offset;
+            }
+            m_offset += size;
+            return;
+        }
+        std::size_t done = 0;
+        while (done < size) {
+            const ssize_t wrote = pwrite(m_fd, data + done, size - done, static_cast<off_t>(m_offset + done));
+            if (wrote < 0 && errno == EINTR)
+                continue;
+            if (wrote < 0)
+                throw std::runtime_error("Cannot write " + m_partPath + ": " + std::strerror(errno));
+            done += static_cast<std::size_t>(wrote);
+        }
+        endZeroRun();
+        m_offset += size;
+    }
+
+    /// Release the preallocated space of the zero run ending at the current
+    /// offset, once the file extends past it: holes can't be punched beyond
+    /// the end of the file. Without preallocation, the range is a hole
+    /// already.
+    void endZeroRun() {
+        if (!m_inZeroRun)
+            return;
+        m_inZeroRun = false;
+        if (m_preallocated) {
+            fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      static_cast<off_t>(m_zeroRunStart), static_cast<off_t>(m_offset - m_zeroRunStart));
+        }
+    }
+
+    std::string m_path;
+    std::string m_partPath;
+    int m_fd = -1;
+    bool m_preallocated = false;
+    std::uint64_t m_offset = 0;
+    bool m_inZeroRun = false;
+    std::uint64_t m_zeroRunStart = 0;
+    std::vector<char> m_block;
+    Sha256 m_hash;
+};
@@ -4,195 +4,195 @@
 /// @brief CLI tool for fetching and displaying Simplestream information.
 ///
 
-#include <ranges>
-#include <jsoncpp/json/json.h>
-#include <httplib.h>
+#include <charconv>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <optional>
+#include "cache.h"
+#include "digest.h"
+#include "download.h"
+#include "signature.h"
+#include "simplestream.h"
+#include "transport.h"
 
 // These values can easily be changed to modify the behaviour of this tool.
-constexpr const char *SIMPLESTREAM_HOST = "cloud-images.ubuntu.com";
-constexpr const char *SIMPLESTREAM_PATH = "/releases/streams/v1/com.ubuntu.cloud:released:download.json";
-constexpr const char *ARCH_NAME         = "amd64";
-constexpr const char *IMAGE_TAG         = "disk1.img";
-constexpr const char *INFO_TAG          = "sha256";
+constexpr const char *SIMPLESTREAM_URL = "https://cloud-images.ubuntu.com/releases/streams/v1/com.ubuntu.cloud:released:download.json";
 
 ///
-/// @brief A collection of static helper methods for type-checked access to 
-/// JSON data. 
-/// @details Throws a std::runtime_error with some helpful info when an
-/// access fails.
+/// @brief Display help text
 ///
-class JsonAccessors {
-public:
-    static const Json::Value& getObject(const Json::Value &val, const std::string &key) {
-        const Json::Value &ret = val[key];
-        if (!ret.isObject())
-            throw std::runtime_error(key + " is not an object");
-        return ret;
-    }
-
-    static Json::String getString(const Json::Value &val, const std::string &key) {
-        const Json::Value &ret = val[key];
-        if (!ret.isString())
-            throw std::runtime_error(key + " is not a string");
-        return ret.asString();
-    }
-
-    static bool getBool(const Json::Value &val, const std::string &key) {
-        const Json::Value &ret = val[key];
-        if (!ret.isBool())
-            throw std::runtime_error(key + " is not a boolean");
-        return ret.asBool();
-    }
-
-    static Json::String getLastMemberName(const Json::Value &val) {
-        Json::Value::Members members = val.getMemberNames();
-        if (members.empty())
-            throw std::runtime_error("object has no members");
-        return members.back();
-    }
-};
+void printUsage()
+{
+    std::cout << "Usage: simplestream [OPTION]... <release>...\n";
+    std::cout << "Fetch and display the latest Ubuntu Cloud image information.\n\n";
+    std::cout << "  -l, --list                  List currently supported Ubuntu releases\n";
+    std::cout << "  -c, --current               Current Ubuntu LTS version\n";
+    std::cout << "  -s, --sha256 <release>...   SHA256 checksum of disk1.img\n";
+    std::cout << "  -i, --item <name|ftype>     Item to checksum instead of disk1.img (repeatable)\n";
+    std::cout << "      --verify <file>         Check a file against the checksums (-s)\n";
+    std::cout << "      --download <dir>        Download the items (-s) to a directory\n";
+    std::cout << "  -u, --url <url>             Simplestream document to fetch\n";
+    std::cout << "      --record <cassette>     Record the fetched exchanges to a file\n";
+    std::cout << "      --replay <cassette>     Replay recorded exchanges instead of fetching\n";
+    std::cout << "      --replay-scale <factor> Scale recorded timing on replay (0 for none)\n";
+    std::cout << "      --cache                 Cache fetched documents, in the default directory\n";
+    std::cout << "      --cache-dir <dir>       Cache fetched documents in a directory\n";
+    std::cout << "      --no-cache              Don't cache, overriding --cache and --cache-dir\n";
+    std::cout << "      --min-ttl <seconds>     Cache the document for at least this long\n";
+    std::cout << "      --max-ttl <seconds>     Cache the document for at most this long\n";
+    std::cout << "      --ttl-jitter <fraction> Shorten cache expiry randomly by up to this much\n";
+    std::cout << "      --keyring <file>        Keyring to verify signed (.sjson) streams with\n";
+    std::cout << "  -h, --help                  Display this help and exit\n\n";
+    std::cout << "Arguments:\n";
+    std::cout << "  release                     Release version, name, or initial\n\n";
+}
 
 ///
-/// @brief Provides easy access to relevant product details.
-/// @details Stores a reference to a Json::Value to a member of the "products"
-/// object in the Simplestream JSON document.
+/// @brief Parse all of `text` as a number.
+/// @return whether `text` is a number
 ///
-class Product : private JsonAccessors {
-public:
-    explicit Product(const Json::Value &val) : m_prod(val) {}
-    Product(const Product &other) : m_prod(other.m_prod) {}
-
-    explicit operator bool() const { return !!m_prod; }
-
-    bool getSupported() const { return getBool(m_prod, "supported"); }
-    Json::String getAliases() const { return getString(m_prod, "aliases"); }
-    Json::String getRelease() const { return getString(m_prod, "release"); }
-    Json::String getReleaseTitle() const { return getString(m_prod, "release_title"); }
-    Json::String getVersion() const { return getString(m_prod, "version"); }
-    
-    Json::String getPubname(const std::string &rev = {}) const {
-        const auto &revision = getRevisionObject(rev);
-        return getString(revision, "pubname");
-    }
-
-    Json::String getImageInfo(const std::string &rev = {}) const {
-        const auto &revision = getRevisionObject(rev);
-        const auto &items = getObject(revision, "items");
-        const auto &image = getObject(items, IMAGE_TAG);
-        return getString(image, INFO_TAG);
-    }
-
-private:
-    Product(Product&&) = delete;
+template<typename T>
+bool parseNumber(std::string_view text, T &value)
+{
+    const auto end = text.data() + text.size();
+    const auto [parsed, err] = std::from_chars(text.data(), end, value);
+    return err == std::errc() && parsed == end;
+}
 
-    const Json::Value& getRevisionObject(std::string revision) const {
-        const auto &versions = getObject(m_prod, "versions");
-        if (revision.empty()) {
-            revision = getLastMemberName(versions);
-        }
-        return getObject(versions, revision);
-    }
-    
-    const Json::Value &m_prod;
+///
+/// @brief A document, and the cache entry to store it under once it proved
+/// valid.
+///
+struct FetchedDocument {
+    std::string body;
+    // Set when a new body was fetched that may be cached.
+    std::optional<CacheEntry> entry;
 };
 
 ///
-/// @brief Provides high-level access to relevant products in a Simplestream
-///  JSON document.
+/// @brief Fetch the document at `path` with `transport`, using the copy in
+/// `cache` while it is fresh and revalidating it once it has expired.
+/// @details A newly fetched body isn't cached here: the caller stores it
+/// with the returned entry once it parsed, and its signature checked out.
+/// @param cache the document cache, or nullptr to always fetch
+/// @param policy decides when a fetched document expires
+/// @param url the document's URL, which keys the cache
+/// @return the document
+/// @throws std::runtime_error if the document couldn't be fetched
 ///
-class Simplestream : private JsonAccessors {
-public:
-    using Products = std::vector<Product>;
-
-    explicit Simplestream(const std::string &document) {
-        Json::Reader reader;
-        if (!reader.parse(document, m_root))
-            throw std::runtime_error(reader.getFormattedErrorMessages());
-    }
-    
-    Products getProducts() const {
-        const auto &products = getObject(m_root, "products");
-        // Only concerned with amd64 architecture for cloud images
-        auto filter = [](const Json::String &prod) { return prod.ends_with(ARCH_NAME); };
-        std::ranges::filter_view productNames{products.getMemberNames(), filter};
-        
-        Products ret;
-        for (const auto &prodName : productNames) {
-            ret.emplace_back(getObject(products, prodName));
-        }
-        return ret;
-    }
-
-    Products getSupportedProducts() const {
-        Products ret;
-        const Products prods = getProducts();
-        for (const auto &prod : prods) {
-            if (prod.getSupported()) {
-                ret.emplace_back(prod);
+FetchedDocument fetchDocument(Transport &transport, const std::string &path, const DocumentCache *cache,
+                          const CachePolicy &policy, const std::string &url)
+{
+    std::optional<CacheEntry> cached = cache ? cache->lookup(url) : std::nullopt;
+    std::optional<std::string> cachedBody;
+    std::optional<RefreshLease> lease;
+    if (cached) {
+        // Of the processes sharing the cache, only the holder of the lease
+        //  refreshes an expired copy, while the others keep using it.
+        //  The new holder first checks whether the previous one refreshed
+        //  the copy meanwhile.
+        if (!cached->fresh()) {
+            lease.emplace(*cache, url);
+            if (!lease->held() || ((cached = cache->lookup(url)) && cached->fresh())) {
+                if ((cachedBody = cache->readBody(url)))
+                    return {std::move(*cachedBody), std::nullopt};
             }
         }
-        return ret;
-    }
-
-    Product getCurrentProduct() const {
-        const Products prods = getProducts();
-        for (const auto &prod : prods) {
-            auto aliases = prod.getAliases();
-            // I think "current" best equates to the "default" product. Could
-            //  the latest product could be a pre-release?
-            if (aliases.find("default") != aliases.npos) {
-                return prod;
-            }
+        // This process refreshes the expired copy, so set up the connection
+        //  while the copy is read for revalidation.
+        if (lease && lease->held() && !(cached && cached->fresh())) {
+            transport.warmUp(path);
         }
-        return Product(Json::nullValue);
+        cachedBody = cached ? cache->readBody(url) : std::nullopt;
+        if (cachedBody && cached->fresh())
+            return {std::move(*cachedBody), std::nullopt};
     }
 
-    Product findProduct(const std::string_view &release) {
-        const Products prods = getProducts();
-        for (const auto &prod : prods) {
-            // Split comma-separated "aliases" into a range-view and filter
-            //  out "lts" since that's common to multiple products.
-            const auto alias = prod.getAliases();
-            auto aliases = alias |
-                std::views::lazy_split(',') |
-                std::views::filter([](auto a) {
-                    return !std::ranges::equal(a, std::string_view("lts"));
-                });
-            // `release` matches any of a product's aliases (e.g. "noble", "default")
-            for (auto a : aliases) {
-                if (std::ranges::equal(a, release)) {
-                    return prod;
-                }
-            }
-            // `release` contains a version string (e.g. "Ubuntu-24.04")
-            if (release.find(prod.getVersion()) != release.npos) {
-                return prod;
-            }
-        }
-        return Product(Json::nullValue);
+    httplib::Headers headers;
+    if (cachedBody && !cached->etag.empty())
+        headers.emplace("If-None-Match", cached->etag);
+    if (cachedBody && !cached->lastModified.empty())
+        headers.emplace("If-Modified-Since", cached->lastModified);
+    // A cached body here is an expired copy this process holds the lease
+    //  for. If the refresh fails, it's used like the other processes do.
+    std::string body;
+    ResponseHead reply;
+    try {
+        reply = transport.get(path, body, headers);
+    } catch (const std::runtime_error&) {
+        if (cachedBody)
+            return {std::move(*cachedBody), std::nullopt};
+        throw;
     }
 
-private:
-    // Prevent default copy and move constructors.
-    Simplestream(const Simplestream&) = delete;
-    Simplestream(Simplestream&&) = delete;
-    
-    Json::Value m_root;
-};
+    CacheEntry entry;
+    const std::string cacheControl = reply.header("Cache-Control");
+    entry.expires = policy.expiry(cacheControl, reply.header("Expires"), reply.header("Date"), reply.header("Age"));
+    const bool storable = CachePolicy::storable(cacheControl);
+    if (reply.status == 304 && cachedBody) {
+        entry.etag = cached->etag;
+        entry.lastModified = cached->lastModified;
+        if (storable)
+            cache->storeEntry(url, entry);
+        return {std::move(*cachedBody), std::nullopt};
+    }
+    if (reply.status != 200) {
+        if (cachedBody)
+            return {std::move(*cachedBody), std::nullopt};
+        throw std::runtime_error("HTTP status " + std::to_string(reply.status));
+    }
+    if (!cache || !storable)
+        return {std::move(body), std::nullopt};
+    entry.etag = reply.header("ETag");
+    entry.lastModified = reply.header("Last-Modified");
+    return {std::move(body), entry};
+}
 
 ///
-/// @brief Display help text
+/// @brief Download the file of an item to `dir`, unless it's there already.
+/// @param mirrorPath the path of the mirror root, which item paths are
+/// relative to
+/// @return the path of the downloaded file
+/// @throws std::runtime_error if the file couldn't be downloaded or doesn't
+/// match the item's checksum
 ///
-void printUsage()
+std::string downloadItem(Transport &transport, const std::string &mirrorPath, const Json::Value &item,
+                         const std::string &dir, const FileDigest &digests)
 {
-    std::cout << "Usage: simplestream [OPTION]... <release>...\n";
-    std::cout << "Fetch and display the latest Ubuntu Cloud image information.\n\n";
-    std::cout << "  -l, --list                  List currently supported Ubuntu releases\n";
-    std::cout << "  -c, --current               Current Ubuntu LTS version\n";
-    std::cout << "  -s, --sha256 <release>...   SHA256 checksum of disk1.img\n";
-    std::cout << "  -h, --help                  Display this help and exit\n\n";
-    std::cout << "Arguments:\n";
-    std::cout << "  release                     Release version, name, or initial\n\n";
+    const auto path = JsonAccessors::tryGetString(item, "path");
+    if (!path)
+        throw std::runtime_error(describe(path.error()));
+    const auto checksum = JsonAccessors::tryGetString(item, INFO_TAG);
+    if (!checksum)
+        throw std::runtime_error(describe(checksum.error()));
+    const std::uint64_t size = item["size"].isUInt64() ? item["size"].asUInt64() : 0;
+    const std::string target = (std::filesystem::path(dir) / std::filesystem::path(*path).filename()).string();
+    if (std::filesystem::exists(target) && digests.sha256(target) == *checksum)
+        return target;
+
+    ImageWriter writer(target, size);
+    std::string writeError;
+    const auto reply = transport.get(mirrorPath + *path, {}, [&](const char *data, std::size_t length) {
+        try {
+            writer.write(data, length);
+            return true;
+        } catch (const std::runtime_error &err) {
+            writeError = err.what();
+            return false;
+        }
+    });
+    if (!writeError.empty())
+        throw std::runtime_error(writeError);
+    if (reply.status != 200)
+        throw std::runtime_error("HTTP status " + std::to_string(reply.status) + " for " + *path);
+    // The digest was computed as the image was written, so a later
+    //  --verify needn't read it again.
+    digests.remember(target, writer.commit(*checksum));
+    return target;
 }
 
 ///
@@ -217,8 +217,35 @@ int main(int argc, char *argv[])
     bool usage = false;
     // Release argument(s) for sha256 option
     std::vector<std::string_view> releases;
+    // Item argument(s) for sha256 option
+    std::vector<std::string_view> items;
+    // Option values
+    std::string_view streamUrl = SIMPLESTREAM_URL;
+    std::string recordPath;
+    std::string replayPath;
+    std::string_view replayScale = "1";
+    std::string_view minTtl = "0";
+    std::string_view maxTtl = "86400";
+    std::string_view ttlJitter = "0.1";
+    std::string cacheDir;
+    bool useCache = false;
+    bool noCache = false;
+    std::string keyring = DEFAULT_KEYRING;
+    // File argument(s) for verify option
+    std::vector<std::string> verifyPaths;
+    std::string downloadDir;
+    // Setters for the values of the options parsed so far, in order. Each one
+    //  takes the next argument.
+    std::deque<std::function<void(std::string_view)>> values;
+    const auto setItem = [&](std::string_view val) { items.push_back(val); };
+    const auto setUrl = [&](std::string_view val) { streamUrl = val; };
     // Parse command line arguments. Short options can be stacked (e.g. -lc).
     for (auto arg : args) {
+        if (!values.empty()) {
+            values.front()(arg);
+            values.pop_front();
+            continue;
+        }
         bool parsed = false;
         bool dashed = arg.starts_with('-');
         // After receiving the sha256 option, any argument not starting with a
@@ -227,18 +254,98 @@ int main(int argc, char *argv[])
             parsed = true;
             releases.push_back(arg);
         }
-        // Don't look for short options inside long options.
+        // Don't look for short options inside long options. Stacked value
+        //  options take the next arguments in the order of their letters,
+        //  e.g. -ui <url> <item>.
         dashed = dashed && !arg.starts_with("--");
-        if (arg == "--list" || (dashed && arg.find('l') != arg.npos)) {
+        for (const char letter : dashed ? arg.substr(1) : std::string_view()) {
+            switch (letter) {
+            case 'l':
+                parsed = list = true;
+                break;
+            case 'c':
+                parsed = current = true;
+                break;
+            case 's':
+                parsed = sha256 = true;
+                break;
+            case 'i':
+                parsed = true;
+                values.push_back(setItem);
+                break;
+            case 'u':
+                parsed = true;
+                values.push_back(setUrl);
+                break;
+            case 'h':
+                parsed = usage = true;
+                break;
+            }
+        }
+        if (arg == "--list") {
             parsed = list = true;
         }
-        if (arg == "--current" || (dashed && arg.find('c') != arg.npos)) {
+        if (arg == "--current") {
             parsed = current = true;
         }
-        if (arg == "--sha256" || (dashed && arg.find('s') != arg.npos)) {
+        if (arg == "--sha256") {
             parsed = sha256 = true;
         }
-        if (arg == "--help" || (dashed && arg.find('h') != arg.npos)) {
+        if (arg == "--item") {
+            parsed = true;
+            values.push_back(setItem);
+        }
+        if (arg == "--url") {
+            parsed = true;
+            values.push_back(setUrl);
+        }
+        if (arg == "--record") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { recordPath = val; });
+        }
+        if (arg == "--replay") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { replayPath = val; });
+        }
+        if (arg == "--replay-scale") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { replayScale = val; });
+        }
+        if (arg == "--cache") {
+            parsed = useCache = true;
+        }
+        if (arg == "--cache-dir") {
+            parsed = useCache = true;
+            values.push_back([&](std::string_view val) { cacheDir = val; });
+        }
+        if (arg == "--no-cache") {
+            parsed = noCache = true;
+        }
+        if (arg == "--min-ttl") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { minTtl = val; });
+        }
+        if (arg == "--max-ttl") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { maxTtl = val; });
+        }
+        if (arg == "--ttl-jitter") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { ttlJitter = val; });
+        }
+        if (arg == "--verify") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { verifyPaths.emplace_back(val); });
+        }
+        if (arg == "--download") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { downloadDir = val; });
+        }
+        if (arg == "--keyring") {
+            parsed = true;
+            values.push_back([&](std::string_view val) { keyring = val; });
+        }
+        if (arg == "--help") {
             parsed = usage = true;
         }
         if (!parsed) {
@@ -247,30 +354,120 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
     }
-
     // -h, --help
-    // Print and exit before downloading and parsing JSON
+    // Print and exit before validating the other options and
+    //  downloading and parsing JSON
     if (usage) {
         printUsage();
         return EXIT_SUCCESS;
     }
 
-    // Fetch the latest Ubuntu Cloud image information
-    httplib::SSLClient client(SIMPLESTREAM_HOST);
-    auto reply = client.Get(SIMPLESTREAM_PATH);
-    if (!reply) {
-        std::cout << "error code: " << reply.error() << std::endl;
-        auto result = client.get_openssl_verify_result();
-        if (result) {
-            std::cout << "verify error: " << X509_verify_cert_error_string(result) << std::endl;
-        }
+    if (!values.empty()) {
+        std::cout << "error: Missing option value.\n\n";
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    if (items.empty()) {
+        items.push_back(IMAGE_TAG);
+    }
+    if ((!verifyPaths.empty() || !downloadDir.empty()) && !sha256) {
+        std::cout << "error: --verify and --download require -s.\n\n";
+        printUsage();
         return EXIT_FAILURE;
     }
+    // Cassettes hold bodies in memory and in JSON, which suits documents but
+    //  not multi-gigabyte images.
+    if (!downloadDir.empty() && (!recordPath.empty() || !replayPath.empty())) {
+        std::cout << "error: --download can't be combined with --record or --replay.\n\n";
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    double scale = 0;
+    if (!parseNumber(replayScale, scale) || scale < 0) {
+        std::cout << "error: Expected a non-negative replay scale.\n\n";
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    CachePolicy policy;
+    long long minSeconds = 0, maxSeconds = 0;
+    if (!parseNumber(minTtl, minSeconds) || !parseNumber(maxTtl, maxSeconds) ||
+        minSeconds < 0 || maxSeconds < minSeconds) {
+        std::cout << "error: Expected TTLs in seconds, with --min-ttl at most --max-ttl.\n\n";
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    policy.minTtl = std::chrono::seconds(minSeconds);
+    policy.maxTtl = std::chrono::seconds(maxSeconds);
+    if (!parseNumber(ttlJitter, policy.jitter) || policy.jitter < 0 || policy.jitter > 1) {
+        std::cout << "error: Expected a TTL jitter between 0 and 1.\n\n";
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    // Split the URL into the scheme, host and port that httplib::Client
+    //  expects and the path of the document.
+    if (!(streamUrl.starts_with("https://") || streamUrl.starts_with("http://"))) {
+        std::cout << "error: Expected an http:// or https:// URL.\n\n";
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    const auto pathStart = std::min(streamUrl.find('/', streamUrl.find("://") + 3), streamUrl.size());
+    const std::string streamHost(streamUrl.substr(0, pathStart));
+    const std::string streamPath = pathStart < streamUrl.size() ? std::string(streamUrl.substr(pathStart)) : "/";
+    // Item paths are relative to the mirror root, where "streams/" is.
+    const auto streamsStart = streamPath.rfind("streams/");
+    const std::string mirrorPath = streamPath.substr(0, streamsStart != streamPath.npos ? streamsStart : streamPath.rfind('/') + 1);
 
     try {
+        // Fetch the latest Ubuntu Cloud image information, or replay it from
+        //  a cassette. Recording and replaying bypass the cache so that the
+        //  cassette holds the real exchanges.
+        std::unique_ptr<Transport> transport;
+        if (!replayPath.empty()) {
+            transport = std::make_unique<ReplayTransport>(replayPath, scale);
+        } else {
+            transport = std::make_unique<HttpTransport>(streamHost);
+        }
+        if (!recordPath.empty()) {
+            transport = std::make_unique<RecordingTransport>(std::move(transport), recordPath);
+        }
+        // Caching is opt-in, so that output is never stale unless asked for.
+        std::optional<DocumentCache> cache;
+        if (useCache && !noCache && replayPath.empty() && recordPath.empty()) {
+            cache.emplace(cacheDir.empty() ? DocumentCache::defaultDirectory() : std::filesystem::path(cacheDir));
+        }
+        const std::string url(streamUrl);
+        const FetchedDocument fetched = fetchDocument(*transport, streamPath, cache ? &*cache : nullptr,
+                                                      policy, url);
+        const std::string &body = fetched.body;
+
+        // A signed stream is verified while its JSON is parsed, unless the
+        //  same document was verified before. Nothing is output until the
+        //  verification succeeds.
+        std::string signedText;
+        std::future<bool> verification;
+        if (streamUrl.ends_with(".sjson")) {
+            signedText = Signature::signedText(body);
+            const std::string digest = Sha256::hex(body);
+            // An unreadable keyring is left for gpgv to report.
+            const auto keyringDigest = cache ? Signature::fileSha256(keyring) : std::nullopt;
+            if (!keyringDigest || !cache->verified(digest, *keyringDigest)) {
+                verification = std::async(std::launch::async, [&, digest, keyringDigest] {
+                    const bool good = Signature::verify(body, keyring);
+                    if (good && keyringDigest)
+                        cache->storeVerified(digest, *keyringDigest);
+                    return good;
+                });
+            }
+        }
+
         // Parse Simplestream formatted JSON from the reply
-        Simplestream stream(reply->body);
-        
+        Simplestream stream(signedText.empty() ? body : signedText);
+        if (verification.valid() && !verification.get())
+            throw std::runtime_error("Bad signature, or not signed by a key in " + keyring);
+        // Only a document that parsed and is signed correctly is cached.
+        if (fetched.entry)
+            cache->store(url, *fetched.entry, body);
+
         // -l, --list
         if (list) {
             std::cout << "Suported Ubuntu releases:" << std::endl;
@@ -288,22 +485,86 @@ int main(int argc, char *argv[])
             std::cout << "  " << prod.getPubname() << std::endl;
         }
 
-        // -s, --sha256 <release>...
+        // -s, --sha256 <release>... [-i, --item <name|ftype>]...
         if (sha256) {
             if (releases.empty()) {
                 std::cout << "error: No release specified.\n\n";
                 printUsage();
                 return EXIT_FAILURE;
             }
+            // Checksums printed so far, for --verify.
+            std::map<Json::String, std::string> checksums;
+            // Files unchanged since they last matched aren't read again.
+            const FileDigest digests(cache ? &*cache : nullptr);
+            bool failed = false;
             for (const auto &release : releases) {
+                // A malformed product only fails its own lookup, so use the
+                //  non-throwing accessors and carry on with the next release.
                 const auto &prod = stream.findProduct(release);
-                if (prod) {
-                    std::cout << "SHA256 checksum for " << IMAGE_TAG << " of " << prod.getPubname() << ":\n";
-                    std::cout << "  " << prod.getImageInfo() << std::endl;
-                } else {
+                if (!prod) {
                     std::cout << "error: Release \"" << release << "\" not found.\n";
+                    continue;
+                }
+                const auto pubname = prod.tryGetPubname();
+                if (!pubname) {
+                    std::cout << "error: Release \"" << release << "\": " << describe(pubname.error()) << ".\n";
+                    failed = true;
+                    continue;
+                }
+                for (const auto &name : items) {
+                    const auto info = prod.tryGetItemInfo(name);
+                    if (!info) {
+                        std::cout << "error: Item \"" << name << "\" of " << *pubname << ": " << describe(info.error()) << ".\n";
+                        failed = true;
+                        continue;
+                    }
+                    std::cout << "SHA256 checksum for " << name << " of " << *pubname << ":\n";
+                    std::cout << "  " << *info << std::endl;
+                    checksums.emplace(*info, std::string(name) + " of " + *pubname);
+
+                    // --download <dir>
+                    if (!downloadDir.empty()) {
+                        try {
+                            const auto file = downloadItem(*transport, mirrorPath, **prod.tryGetItem(name),
+                                                           downloadDir, digests);
+                            std::cout << "  downloaded to " << file << std::endl;
+                        } catch (const std::runtime_error &err) {
+                            std::cout << "error: Download of " << name << " for " << *pubname << " failed: " << err.what() << ".\n";
+                            failed = true;
+                        }
+                    }
+                }
+            }
+
+            // --verify <file>...
+            for (const auto &path : verifyPaths) {
+                // A file that can't be read fails on its own, like a mismatch.
+                std::string digest;
+                try {
+                    digest = digests.sha256(path);
+                } catch (const std::runtime_error &err) {
+                    std::cout << path << ": FAILED (" << err.what() << ")\n";
+                    failed = true;
+                    continue;
+                }
+                const auto match = checksums.find(digest);
+                if (match == checksums.end()) {
+                    std::cout << path << ": FAILED\n";
+                    failed = true;
+                } else {
+                    std::cout << path << ": OK, " << match->second << '\n';
+                    // Let later checks of the file, once its stamp changed,
+                    //  confirm the digest on all cores. That's only an
+                    //  optimization, so the file having gone meanwhile isn't
+                    //  an error.
+                    try {
+                        digests.seal(path, digest);
+                    } catch (const std::runtime_error&) {
+                    }
                 }
             }
+            if (failed)
+                return EXIT_FAILURE;
         }
     } catch (const std::runtime_error& err) {
         std::cout << "error: " << err.what() << std::endl;
@@ -0,0 +1,57 @@
+///
+/// @brief SHA-256 digests, of fetched documents as well as of local files.
+///
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <openssl/evp.h>
+
+///
+/// @brief Incremental SHA-256 with OpenSSL.
+///
+class Sha256 {
+public:
+    Sha256() : m_ctx(EVP_MD_CTX_new()) {
+        if (!m_ctx || !EVP_DigestInit_ex(m_ctx, EVP_sha256(), nullptr)) {
+            EVP_MD_CTX_free(m_ctx);
+            throw std::runtime_error("Cannot compute SHA-256 digest");
+        }
+    }
+    ~Sha256() { EVP_MD_CTX_free(m_ctx); }
+
+    void update(const void *data, std::size_t size) { EVP_DigestUpdate(m_ctx, data, size); }
+
+    /// @return the raw digest
+    std::string final() {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+        EVP_DigestFinal_ex(m_ctx, digest, &size);
+        return std::string(reinterpret_cast<const char*>(digest), size);
+    }
+
+    /// @return the lowercase hex SHA-256 digest of `data`
+    static std::string hex(std::string_view data) {
+        Sha256 hasher;
+        hasher.update(data.data(), data.size());
+        return toHex(hasher.final());
+    }
+
+    /// @return `digest` in lowercase hex
+    static std::string toHex(const std::string &digest) {
+        static constexpr char HEX[] = "0123456789abcdef";
+        std::string ret;
+        for (unsigned char c : digest) {
+            ret += HEX[c >> 4];
+            ret += HEX[c & 0xf];
+        }
+        return ret;
+    }
+
+private:
+    Sha256(const Sha256&) = delete;
+
+    EVP_MD_CTX *m_ctx;
+};
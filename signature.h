@@ -0,0 +1,159 @@
+///
+/// @brief Verification of signed Simplestream documents.
+/// @details Signed streams (.sjson) are OpenPGP clearsigned JSON documents.
+/// The signature is checked with gpgv against a keyring, and the JSON is
+/// extracted from the clearsigned text so that it can be parsed while the
+/// check runs.
+///
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "sha256.h"
+
+extern char **environ;
+
+constexpr const char *GPGV_BINARY = "gpgv";
+constexpr const char *DEFAULT_KEYRING = "/usr/share/keyrings/ubuntu-cloudimage-keyring.gpg";
+
+///
+/// @brief Functions to check and unwrap clearsigned documents.
+///
+class Signature {
+public:
+    /// @return the lowercase hex SHA-256 digest of the file at `path`, or
+    /// nothing if it can't be read
+    static std::optional<std::string> fileSha256(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        std::ostringstream data;
+        if (!file || !(data << file.rdbuf()))
+            return std::nullopt;
+        return Sha256::hex(data.str());
+    }
+
+    ///
+    /// @brief Extract the signed text of a clearsigned document, undoing the
+    /// dash-escaping of lines that start with '-'.
+    /// @details The text isn't trusted until verify() succeeds.
+    /// @throws std::runtime_error if `document` isn't clearsigned
+    ///
+    static std::string signedText(std::string_view document) {
+        constexpr std::string_view BEGIN = "-----BEGIN PGP SIGNED MESSAGE-----\n";
+        constexpr std::string_view SIGNATURE = "\n-----BEGIN PGP SIGNATURE-----";
+        if (!document.starts_with(BEGIN))
+            throw std::runtime_error("Stream is not clearsigned");
+        // The armor headers, e.g. "Hash: SHA512", end at the first empty
+        //  line. Anything else before it means the empty line is missing.
+        std::size_t start = BEGIN.size();
+        for (;;) {
+            const auto eol = document.find('\n', start);
+            if (eol == document.npos)
+                throw std::runtime_error("Stream has no signature");
+            const std::string_view header = document.substr(start, eol - start);
+            start = eol + 1;
+            if (header.empty())
+                break;
+            const std::string_view key = header.substr(0, header.find(": "));
+            if (key.empty() || key.size() == header.size() ||
+                !std::all_of(key.begin(), key.end(), [](unsigned char c) { return std::isalnum(c) || c == '-'; }))
+                throw std::runtime_error("Stream has malformed armor headers");
+        }
+        const auto end = document.find(SIGNATURE, start > 0 ? start - 1 : 0);
+        if (end == document.npos)
+            throw std::runtime_error("Stream has no signature");
+
+        std::string ret;
+        ret.reserve(end + 1 - start);
+        std::string_view text = document.substr(start, end + 1 - start);
+        while (!text.empty()) {
+            const auto eol = text.find('\n');
+            std::string_view line = text.substr(0, eol);
+            if (line.starts_with("- "))
+                line.remove_prefix(2);
+            ret.append(line);
+            ret += '\n';
+            text.remove_prefix(eol == text.npos ? text.size() : eol + 1);
+        }
+        return ret;
+    }
+
+    ///
+    /// @brief Check the signature of a clearsigned document with gpgv.
+    /// @return whether the signature is good and made by a key in `keyring`
+    /// @throws std::runtime_error if gpgv can't be run
+    ///
+    static bool verify(std::string_view document, const std::string &keyring) {
+        int input[2];
+        if (pipe2(input, O_CLOEXEC) != 0)
+            throw std::runtime_error("Cannot create pipe to gpgv");
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+        // The caller's signal mask (see below) must not leak into gpgv.
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t none;
+        sigemptyset(&none);
+        posix_spawnattr_setsigmask(&attr, &none);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+        std::vector<char*> argv = {
+            const_cast<char*>(GPGV_BINARY),
+            const_cast<char*>("--keyring"),
+            const_cast<char*>(keyring.c_str()),
+            const_cast<char*>("-"),
+            nullptr,
+        };
+        pid_t pid = 0;
+        const int err = posix_spawnp(&pid, GPGV_BINARY, &actions, &attr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        close(input[0]);
+        if (err != 0) {
+            close(input[1]);
+            throw std::runtime_error(std::string("Cannot run ") + GPGV_BINARY);
+        }
+
+        // gpgv may exit before reading everything, e.g. on a bad keyring, so
+        //  block SIGPIPE in this thread and let the write fail instead.
+        sigset_t pipeSignal, previous;
+        sigemptyset(&pipeSignal);
+        sigaddset(&pipeSignal, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeSignal, &previous);
+        while (!document.empty()) {
+            const ssize_t written = write(input[1], document.data(), document.size());
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                break;
+            document.remove_prefix(static_cast<std::size_t>(written));
+        }
+        close(input[1]);
+        // Discard a SIGPIPE raised above before unblocking it.
+        const timespec poll = {};
+        sigtimedwait(&pipeSignal, nullptr, &poll);
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+};
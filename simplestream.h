@@ -0,0 +1,399 @@
+///
+/// @author Jonathan Pence
+/// @date 2024-10-03
+/// @brief Type-checked access to the products of a Simplestream JSON document.
+///
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include <jsoncpp/json/json.h>
+
+// These values can easily be changed to modify the behaviour of this tool.
+constexpr const char *ARCH_NAME         = "amd64";
+constexpr const char *IMAGE_TAG         = "disk1.img";
+constexpr const char *INFO_TAG          = "sha256";
+
+///
+/// @brief Error codes reported by the non-throwing JSON accessors.
+///
+enum class JsonErrorCode : std::uint8_t {
+    NotObject,
+    NotString,
+    NotBool,
+    NoMembers,
+    NotFound,
+};
+
+///
+/// @brief An error reported by the non-throwing JSON accessors, with the key
+/// of the member that failed.
+///
+struct JsonError {
+    JsonErrorCode code;
+    std::string key;
+};
+
+/// @return `err` as text naming its key, e.g. "sha256 is not a string"
+inline std::string describe(const JsonError &err) {
+    const char *what = "is invalid";
+    switch (err.code) {
+    case JsonErrorCode::NotObject: what = "is not an object"; break;
+    case JsonErrorCode::NotString: what = "is not a string"; break;
+    case JsonErrorCode::NotBool:   what = "is not a boolean"; break;
+    case JsonErrorCode::NoMembers: what = "has no members"; break;
+    case JsonErrorCode::NotFound:  what = "not found"; break;
+    }
+    return err.key.empty() ? std::string(what) : err.key + " " + what;
+}
+
+///
+/// @brief Holds either a value or a JsonError, in the style of C++23
+/// std::expected.
+///
+template <typename T>
+class Expected {
+public:
+    Expected(T value) : m_value(std::move(value)) {}
+    Expected(JsonError err) : m_value(err) {}
+
+    bool has_value() const { return m_value.index() == 0; }
+    explicit operator bool() const { return has_value(); }
+
+    const T& operator*() const { return std::get<0>(m_value); }
+    T& operator*() { return std::get<0>(m_value); }
+    const T* operator->() const { return &std::get<0>(m_value); }
+
+    const JsonError& error() const { return std::get<1>(m_value); }
+
+private:
+    std::variant<T, JsonError> m_value;
+};
+
+///
+/// @brief A collection of static helper methods for type-checked access to 
+/// JSON data. 
+/// @details The tryGet methods report a failed access as a JsonError. The get
+/// methods wrap them and throw a std::runtime_error with some helpful info
+/// instead.
+///
+class JsonAccessors {
+public:
+    static Expected<const Json::Value*> tryGetObject(const Json::Value &val, const std::string &key) {
+        const Json::Value *ret = member(val, key);
+        if (!ret || !ret->isObject())
+            return JsonError{JsonErrorCode::NotObject, key};
+        return ret;
+    }
+
+    static Expected<Json::String> tryGetString(const Json::Value &val, const std::string &key) {
+        const Json::Value *ret = member(val, key);
+        if (!ret || !ret->isString())
+            return JsonError{JsonErrorCode::NotString, key};
+        return ret->asString();
+    }
+
+    static Expected<bool> tryGetBool(const Json::Value &val, const std::string &key) {
+        const Json::Value *ret = member(val, key);
+        if (!ret || !ret->isBool())
+            return JsonError{JsonErrorCode::NotBool, key};
+        return ret->asBool();
+    }
+
+    static Expected<Json::String> tryGetLastMemberName(const Json::Value &val) {
+        Json::Value::Members members = val.getMemberNames();
+        if (members.empty())
+            return JsonError{JsonErrorCode::NoMembers, "object"};
+        return members.back();
+    }
+
+    static const Json::Value& getObject(const Json::Value &val, const std::string &key) {
+        return *unwrap(tryGetObject(val, key));
+    }
+
+    static Json::String getString(const Json::Value &val, const std::string &key) {
+        return unwrap(tryGetString(val, key));
+    }
+
+    static bool getBool(const Json::Value &val, const std::string &key) {
+        return unwrap(tryGetBool(val, key));
+    }
+
+    static Json::String getLastMemberName(const Json::Value &val) {
+        return unwrap(tryGetLastMemberName(val));
+    }
+
+protected:
+    /// @return the member `key` of `val`, or nullptr if `val` is not an object
+    /// or has no such member
+    static const Json::Value* member(const Json::Value &val, std::string_view key) {
+        if (!val.isObject())
+            return nullptr;
+        return val.find(key.data(), key.data() + key.size());
+    }
+
+    /// @return the value held by `ret`
+    /// @throws std::runtime_error describing the error if `ret` holds one
+    template <typename T>
+    static T unwrap(Expected<T> ret) {
+        if (!ret)
+            throw std::runtime_error(describe(ret.error()));
+        return std::move(*ret);
+    }
+};
+
+///
+/// @brief Index of the items in each product version, built for a version
+/// the first time one of its items is looked up.
+/// @details An item can be found by its name (e.g. "disk-kvm.img") or by its
+/// "ftype" (e.g. "squashfs"); names take priority. The index of a version
+/// holds views of the names and ftypes in the document, which a version has
+/// only a handful of, so a lookup scans them without allocating. Invocations
+/// that never look up an item, such as -l and -c, don't pay for indexing.
+/// Lookups may run on several threads at once.
+///
+class ItemIndex {
+public:
+    /// Find an item of a member of a product's "versions" object by name or
+    /// ftype.
+    /// @return the item object, or nullptr if there is no such item
+    const Json::Value* find(const Json::Value &version, std::string_view item) const {
+        std::lock_guard lock(m_mutex);
+        auto [entries, added] = m_versions.try_emplace(&version);
+        if (added)
+            entries->second = indexVersion(version);
+        for (const auto &entry : entries->second) {
+            if (entry.key == item)
+                return entry.item;
+        }
+        return nullptr;
+    }
+
+private:
+    struct Entry {
+        std::string_view key;
+        const Json::Value *item;
+    };
+
+    /// @return the entries of the items of `version` by name, followed by
+    /// their entries by ftype
+    static std::vector<Entry> indexVersion(const Json::Value &version) {
+        std::vector<Entry> ret;
+        const Json::Value *items = version.isObject() ? version.find("items", "items" + 5) : nullptr;
+        if (!items || !items->isObject())
+            return ret;
+        for (auto it = items->begin(); it != items->end(); ++it) {
+            const char *end = nullptr;
+            const char *name = it.memberName(&end);
+            ret.push_back({std::string_view(name, static_cast<std::size_t>(end - name)), &*it});
+        }
+        const std::size_t named = ret.size();
+        for (std::size_t i = 0; i < named; ++i) {
+            const Json::Value *ftype = ret[i].item->isObject() ? ret[i].item->find("ftype", "ftype" + 5) : nullptr;
+            const char *begin = nullptr;
+            const char *end = nullptr;
+            if (ftype && ftype->getString(&begin, &end))
+                ret.push_back({std::string_view(begin, static_cast<std::size_t>(end - begin)), ret[i].item});
+        }
+        return ret;
+    }
+
+    mutable std::mutex m_mutex;
+    mutable std::unordered_map<const Json::Value*, std::vector<Entry>> m_versions;
+};
+
+///
+/// @brief Provides easy access to relevant product details.
+/// @details Stores a reference to a Json::Value to a member of the "products"
+/// object in the Simplestream JSON document, and optionally the ItemIndex
+/// covering its versions.
+///
+class Product : private JsonAccessors {
+public:
+    explicit Product(const Json::Value &val, const ItemIndex *items = nullptr)
+        : m_prod(val), m_items(items) {}
+    Product(const Product &other) : m_prod(other.m_prod), m_items(other.m_items) {}
+
+    explicit operator bool() const { return !!m_prod; }
+
+    Expected<bool> tryGetSupported() const { return tryGetBool(m_prod, "supported"); }
+    Expected<Json::String> tryGetAliases() const { return tryGetString(m_prod, "aliases"); }
+    Expected<Json::String> tryGetVersion() const { return tryGetString(m_prod, "version"); }
+
+    Expected<Json::String> tryGetPubname(const std::string &rev = {}) const {
+        const auto revision = tryGetRevisionObject(rev);
+        if (!revision)
+            return revision.error();
+        return tryGetString(**revision, "pubname");
+    }
+
+    /// Find an item of a revision by name or ftype.
+    /// @return the item object, or JsonErrorCode::NotFound if there is no such
+    /// item
+    Expected<const Json::Value*> tryGetItem(std::string_view item, const std::string &rev = {}) const {
+        const auto revision = tryGetRevisionObject(rev);
+        if (!revision)
+            return revision.error();
+        const Json::Value *image = nullptr;
+        if (m_items) {
+            image = m_items->find(**revision, item);
+        } else {
+            // Not indexed, so fall back to a lookup by name only.
+            const auto items = tryGetObject(**revision, "items");
+            if (!items)
+                return items.error();
+            image = member(**items, item);
+        }
+        if (!image || !image->isObject())
+            return JsonError{JsonErrorCode::NotFound, std::string(item)};
+        return image;
+    }
+
+    Expected<Json::String> tryGetItemInfo(std::string_view item, const std::string &rev = {}) const {
+        const auto image = tryGetItem(item, rev);
+        if (!image)
+            return image.error();
+        return tryGetString(**image, INFO_TAG);
+    }
+
+    bool getSupported() const { return getBool(m_prod, "supported"); }
+    Json::String getAliases() const { return getString(m_prod, "aliases"); }
+    Json::String getRelease() const { return getString(m_prod, "release"); }
+    Json::String getReleaseTitle() const { return getString(m_prod, "release_title"); }
+    Json::String getVersion() const { return getString(m_prod, "version"); }
+    
+    Json::String getPubname(const std::string &rev = {}) const {
+        return unwrap(tryGetPubname(rev));
+    }
+
+    Json::String getImageInfo(const std::string &rev = {}) const {
+        return getItemInfo(IMAGE_TAG, rev);
+    }
+
+    Json::String getItemInfo(std::string_view item, const std::string &rev = {}) const {
+        return unwrap(tryGetItemInfo(item, rev));
+    }
+
+private:
+    Product(Product&&) = delete;
+
+    Expected<const Json::Value*> tryGetRevisionObject(std::string revision) const {
+        const auto versions = tryGetObject(m_prod, "versions");
+        if (!versions)
+            return versions.error();
+        if (revision.empty()) {
+            auto last = tryGetLastMemberName(**versions);
+            if (!last)
+                return JsonError{last.error().code, "versions"};
+            revision = std::move(*last);
+        } else if (!member(**versions, revision)) {
+            return JsonError{JsonErrorCode::NotFound, revision};
+        }
+        return tryGetObject(**versions, revision);
+    }
+    
+    const Json::Value &m_prod;
+    const ItemIndex *m_items;
+};
+
+///
+/// @brief Provides high-level access to relevant products in a Simplestream
+///  JSON document.
+///
+class Simplestream : private JsonAccessors {
+public:
+    using Products = std::vector<Product>;
+
+    explicit Simplestream(const std::string &document) {
+        Json::Reader reader;
+        if (!reader.parse(document, m_root))
+            throw std::runtime_error(reader.getFormattedErrorMessages());
+    }
+    
+    Products getProducts() const {
+        const auto &products = getObject(m_root, "products");
+        // Only concerned with amd64 architecture for cloud images
+        auto filter = [](const Json::String &prod) { return prod.ends_with(ARCH_NAME); };
+        std::ranges::filter_view productNames{products.getMemberNames(), filter};
+        
+        Products ret;
+        for (const auto &prodName : productNames) {
+            // Skip malformed products rather than failing the whole query.
+            const auto prod = tryGetObject(products, prodName);
+            if (prod) {
+                ret.emplace_back(**prod, &m_items);
+            }
+        }
+        return ret;
+    }
+
+    Products getSupportedProducts() const {
+        Products ret;
+        const Products prods = getProducts();
+        for (const auto &prod : prods) {
+            const auto supported = prod.tryGetSupported();
+            if (supported && *supported) {
+                ret.emplace_back(prod);
+            }
+        }
+        return ret;
+    }
+
+    Product getCurrentProduct() const {
+        const Products prods = getProducts();
+        for (const auto &prod : prods) {
+            const auto aliases = prod.tryGetAliases();
+            // I think "current" best equates to the "default" product. Could
+            //  the latest product could be a pre-release?
+            if (aliases && aliases->find("default") != aliases->npos) {
+                return prod;
+            }
+        }
+        return Product(Json::Value::nullSingleton());
+    }
+
+    Product findProduct(const std::string_view &release) const {
+        const Products prods = getProducts();
+        for (const auto &prod : prods) {
+            // Split comma-separated "aliases" into a range-view and filter
+            //  out "lts" since that's common to multiple products. A product
+            //  with malformed "aliases" can still match by version.
+            const auto alias = prod.tryGetAliases();
+            const std::string_view aliasList = alias ? std::string_view(*alias) : std::string_view();
+            auto aliases = aliasList |
+                std::views::lazy_split(',') |
+                std::views::filter([](auto a) {
+                    return !std::ranges::equal(a, std::string_view("lts"));
+                });
+            // `release` matches any of a product's aliases (e.g. "noble", "default")
+            for (auto a : aliases) {
+                if (std::ranges::equal(a, release)) {
+                    return prod;
+                }
+            }
+            // `release` contains a version string (e.g. "Ubuntu-24.04")
+            const auto version = prod.tryGetVersion();
+            if (version && release.find(*version) != release.npos) {
+                return prod;
+            }
+        }
+        return Product(Json::Value::nullSingleton());
+    }
+
+private:
+    // Prevent default copy and move constructors.
+    Simplestream(const Simplestream&) = delete;
+    Simplestream(Simplestream&&) = delete;
+
+    Json::Value m_root;
+    ItemIndex m_items;
+};
@@ -0,0 +1,192 @@
+///
+/// @brief C interface to the Simplestream classes.
+/// @details Every entry point catches all exceptions, which must not cross
+/// into the caller's runtime, and reports them as an ss_status.
+///
+
+#include <cstring>
+#include <new>
+#include "simplestream.h"
+#include "simplestream_c.h"
+
+struct ss_catalog {
+    explicit ss_catalog(const std::string &document) : stream(document) {}
+
+    Simplestream stream;
+};
+
+struct ss_product {
+    explicit ss_product(const Product &prod) : prod(prod) {}
+
+    Product prod;
+};
+
+namespace {
+
+ss_status toStatus(const JsonError &err)
+{
+    return err.code == JsonErrorCode::NotFound ? SS_ERR_NOT_FOUND : SS_ERR_MALFORMED;
+}
+
+///
+/// @brief Copy `value` to a caller-owned buffer, if it fits with its NUL.
+///
+ss_status copyOut(const Expected<Json::String> &value, char *buf, std::size_t size, std::size_t *length)
+{
+    if (!value)
+        return toStatus(value.error());
+    if (length)
+        *length = value->size();
+    if (value->size() >= size || !buf)
+        return SS_ERR_BUFFER_TOO_SMALL;
+    std::memcpy(buf, value->c_str(), value->size() + 1);
+    return SS_OK;
+}
+
+///
+/// @brief Run `body`, translating exceptions into a status.
+///
+template<typename F>
+ss_status guard(F &&body)
+{
+    try {
+        return body();
+    } catch (const std::bad_alloc&) {
+        return SS_ERR_INTERNAL;
+    } catch (const std::runtime_error&) {
+        // The throwing accessors only fail on documents of the wrong shape.
+        return SS_ERR_MALFORMED;
+    } catch (...) {
+        return SS_ERR_INTERNAL;
+    }
+}
+
+ss_status newProduct(const Product &prod, ss_product **product)
+{
+    if (!prod)
+        return SS_ERR_NOT_FOUND;
+    *product = new ss_product(prod);
+    return SS_OK;
+}
+
+} // namespace
+
+extern "C" {
+
+int ss_abi_version(void)
+{
+    return SS_ABI_VERSION;
+}
+
+const char *ss_status_string(ss_status status)
+{
+    switch (status) {
+    case SS_OK:                   return "success";
+    case SS_ERR_INVALID_ARGUMENT: return "invalid argument";
+    case SS_ERR_PARSE:            return "document is not a Simplestream";
+    case SS_ERR_MALFORMED:        return "product is malformed";
+    case SS_ERR_NOT_FOUND:        return "not found";
+    case SS_ERR_BUFFER_TOO_SMALL: return "buffer too small";
+    case SS_ERR_INTERNAL:         return "internal error";
+    }
+    return "unknown status";
+}
+
+ss_status ss_catalog_open(const char *document, size_t length, ss_catalog **catalog)
+{
+    if (!document || !catalog)
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] {
+        try {
+            *catalog = new ss_catalog(std::string(document, length));
+        } catch (const std::runtime_error&) {
+            return SS_ERR_PARSE;
+        }
+        return SS_OK;
+    });
+}
+
+void ss_catalog_close(ss_catalog *catalog)
+{
+    delete catalog;
+}
+
+ss_status ss_find(const ss_catalog *catalog, const char *release, ss_product **product)
+{
+    if (!catalog || !release || !product)
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] { return newProduct(catalog->stream.findProduct(release), product); });
+}
+
+ss_status ss_current(const ss_catalog *catalog, ss_product **product)
+{
+    if (!catalog || !product)
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] { return newProduct(catalog->stream.getCurrentProduct(), product); });
+}
+
+ss_status ss_supported(const ss_catalog *catalog, ss_product **products, size_t capacity, size_t *count)
+{
+    if (!catalog || !count || (capacity && !products))
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] {
+        const auto prods = catalog->stream.getSupportedProducts();
+        *count = prods.size();
+        if (prods.size() > capacity)
+            return SS_ERR_BUFFER_TOO_SMALL;
+        std::size_t created = 0;
+        try {
+            for (; created < prods.size(); ++created) {
+                products[created] = new ss_product(prods[created]);
+            }
+        } catch (...) {
+            while (created > 0) {
+                delete products[--created];
+            }
+            throw;
+        }
+        return SS_OK;
+    });
+}
+
+void ss_product_free(ss_product *product)
+{
+    delete product;
+}
+
+ss_status ss_product_version(const ss_product *product, char *buf, size_t size, size_t *length)
+{
+    if (!product)
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] { return copyOut(product->prod.tryGetVersion(), buf, size, length); });
+}
+
+ss_status ss_product_release_title(const ss_product *product, char *buf, size_t size, size_t *length)
+{
+    if (!product)
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] { return copyOut(product->prod.getReleaseTitle(), buf, size, length); });
+}
+
+ss_status ss_product_pubname(const ss_product *product, const char *revision,
+                             char *buf, size_t size, size_t *length)
+{
+    if (!product)
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] {
+        return copyOut(product->prod.tryGetPubname(revision ? revision : ""), buf, size, length);
+    });
+}
+
+ss_status ss_item_hash(const ss_product *product, const char *item, const char *revision,
+                       char *buf, size_t size, size_t *length)
+{
+    if (!product)
+        return SS_ERR_INVALID_ARGUMENT;
+    return guard([&] {
+        return copyOut(product->prod.tryGetItemInfo(item ? item : IMAGE_TAG, revision ? revision : ""),
+                       buf, size, length);
+    });
+}
+
+} // extern "C"
@@ -0,0 +1,94 @@
+/*
+ * @brief C interface to the Simplestream classes, for calling in from other
+ * runtimes through their FFI instead of launching simplestream per lookup.
+ * @details Catalogs and products are opaque handles. Strings are returned in
+ * buffers owned by the caller: each string function writes a NUL-terminated
+ * string to `buf` if it fits in `size` bytes, and stores the length without
+ * the NUL in `*length` (if not NULL) either way, so a caller can retry with a
+ * large enough buffer after SS_ERR_BUFFER_TOO_SMALL.
+ *
+ * A catalog may be queried from several threads at once. Products are valid
+ * until they are freed, and must be freed before their catalog is closed.
+ * No function throws or aborts on malformed input.
+ */
+
+#ifndef SIMPLESTREAM_C_H
+#define SIMPLESTREAM_C_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SS_API __attribute__((visibility("default")))
+
+/* Bumped whenever a function's signature or behaviour changes incompatibly. */
+#define SS_ABI_VERSION 1
+
+typedef struct ss_catalog ss_catalog;
+typedef struct ss_product ss_product;
+
+typedef enum ss_status {
+    SS_OK = 0,
+    SS_ERR_INVALID_ARGUMENT,
+    SS_ERR_PARSE,
+    SS_ERR_MALFORMED,
+    SS_ERR_NOT_FOUND,
+    SS_ERR_BUFFER_TOO_SMALL,
+    SS_ERR_INTERNAL,
+} ss_status;
+
+/* @return SS_ABI_VERSION of the loaded library */
+SS_API int ss_abi_version(void);
+
+/* @return a static description of `status` */
+SS_API const char *ss_status_string(ss_status status);
+
+/*
+ * Parse a Simplestream document, e.g. one fetched from the Ubuntu Cloud
+ * images stream, into a catalog. The document is copied.
+ */
+SS_API ss_status ss_catalog_open(const char *document, size_t length, ss_catalog **catalog);
+
+SS_API void ss_catalog_close(ss_catalog *catalog);
+
+/*
+ * Find a product by alias ("noble", "n", "default") or by a string that
+ * contains its version ("Ubuntu-24.04"), like `simplestream -s`.
+ */
+SS_API ss_status ss_find(const ss_catalog *catalog, const char *release, ss_product **product);
+
+/* Find the current LTS product, like `simplestream -c`. */
+SS_API ss_status ss_current(const ss_catalog *catalog, ss_product **product);
+
+/*
+ * Store up to `capacity` supported products in `products`, like
+ * `simplestream -l`, and their number in `*count`. Returns
+ * SS_ERR_BUFFER_TOO_SMALL with nothing stored if there are more.
+ */
+SS_API ss_status ss_supported(const ss_catalog *catalog, ss_product **products,
+                              size_t capacity, size_t *count);
+
+SS_API void ss_product_free(ss_product *product);
+
+SS_API ss_status ss_product_version(const ss_product *product, char *buf, size_t size, size_t *length);
+
+SS_API ss_status ss_product_release_title(const ss_product *product, char *buf, size_t size, size_t *length);
+
+/* The pubname of `revision`, or of the latest revision if NULL. */
+SS_API ss_status ss_product_pubname(const ss_product *product, const char *revision,
+                                    char *buf, size_t size, size_t *length);
+
+/*
+ * The SHA256 checksum of an item of `revision` (the latest if NULL), by item
+ * name ("disk-kvm.img") or ftype ("squashfs"), or of disk1.img if NULL.
+ */
+SS_API ss_status ss_item_hash(const ss_product *product, const char *item, const char *revision,
+                              char *buf, size_t size, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLESTREAM_C_H */
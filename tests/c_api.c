@@ -0,0 +1,115 @@
+/*
+ * @brief Checks of the C interface, compiled as C so that simplestream_c.h
+ * is checked to be valid C as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simplestream_c.h"
+
+static const char DOCUMENT[] =
+    "{\"content_id\": \"com.ubuntu.cloud:released:download\", \"format\": \"products:1.0\", \"products\": {"
+    "\"com.ubuntu.cloud:server:22.04:amd64\": {\"aliases\": \"22.04,j,jammy\", \"arch\": \"amd64\","
+    " \"release\": \"jammy\", \"release_title\": \"22.04 LTS\", \"supported\": true, \"version\": \"22.04\","
+    " \"versions\": {\"20240201\": {\"pubname\": \"ubuntu-jammy-22.04-amd64-server-20240201\", \"items\": {"
+    "  \"disk1.img\": {\"ftype\": \"disk1.img\", \"path\": \"d\", \"sha256\": \"d1sk\", \"size\": 10},"
+    "  \"squashfs\": {\"ftype\": \"squashfs\", \"path\": \"s\", \"sha256\": \"5qua5h\", \"size\": 3},"
+    "  \"root.tar.xz\": {\"ftype\": \"root.tar.xz\", \"path\": \"r\", \"sha256\": \"r00t\", \"size\": 5}}}}},"
+    "\"com.ubuntu.cloud:server:24.04:amd64\": {\"aliases\": \"24.04,default,lts,n,noble\", \"arch\": \"amd64\","
+    " \"release\": \"noble\", \"release_title\": \"24.04 LTS\", \"supported\": true, \"version\": \"24.04\","
+    " \"versions\": {\"20240601\": {\"pubname\": \"ubuntu-noble-24.04-amd64-server-20240601\", \"items\": {"
+    "  \"disk1.img\": {\"ftype\": \"disk1.img\", \"path\": \"d\", \"sha256\": \"n0ble\", \"size\": 10}}}}}}}";
+
+static int g_failures = 0;
+
+static void check(int ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("FAILED line %d: %s\n", line, what);
+        ++g_failures;
+    }
+}
+
+#define CHECK(expr) check((expr), #expr, __LINE__)
+
+static void testOpen(void)
+{
+    static const char BAD[] = "{\"products\": ";
+    ss_catalog *catalog = NULL;
+    CHECK(ss_catalog_open(BAD, sizeof(BAD) - 1, &catalog) == SS_ERR_PARSE);
+    CHECK(ss_catalog_open(NULL, 0, &catalog) == SS_ERR_INVALID_ARGUMENT);
+}
+
+static void testFind(const ss_catalog *catalog)
+{
+    ss_product *product = NULL;
+    char buf[64];
+    size_t length = 0;
+    CHECK(ss_find(catalog, "noble", &product) == SS_OK);
+    CHECK(ss_product_version(product, buf, sizeof(buf), &length) == SS_OK);
+    CHECK(strcmp(buf, "24.04") == 0 && length == 5);
+    ss_product_free(product);
+
+    CHECK(ss_find(catalog, "Ubuntu-22.04", &product) == SS_OK);
+    CHECK(ss_product_release_title(product, buf, sizeof(buf), NULL) == SS_OK);
+    CHECK(strcmp(buf, "22.04 LTS") == 0);
+    ss_product_free(product);
+
+    CHECK(ss_find(catalog, "warty", &product) == SS_ERR_NOT_FOUND);
+}
+
+static void testItemHash(const ss_catalog *catalog)
+{
+    ss_product *product = NULL;
+    char buf[64];
+    size_t length = 0;
+    CHECK(ss_find(catalog, "jammy", &product) == SS_OK);
+    CHECK(ss_item_hash(product, NULL, NULL, buf, sizeof(buf), NULL) == SS_OK);
+    CHECK(strcmp(buf, "d1sk") == 0);
+    CHECK(ss_item_hash(product, "root.tar.xz", NULL, buf, sizeof(buf), NULL) == SS_OK);
+    CHECK(strcmp(buf, "r00t") == 0);
+    CHECK(ss_item_hash(product, "squashfs", "20240201", buf, sizeof(buf), NULL) == SS_OK);
+    CHECK(strcmp(buf, "5qua5h") == 0);
+    CHECK(ss_item_hash(product, "disk-kvm.img", NULL, buf, sizeof(buf), NULL) == SS_ERR_NOT_FOUND);
+    CHECK(ss_item_hash(product, NULL, "19700101", buf, sizeof(buf), NULL) == SS_ERR_NOT_FOUND);
+
+    /* The length is reported without the NUL, also when it doesn't fit. */
+    CHECK(ss_product_pubname(product, NULL, buf, 4, &length) == SS_ERR_BUFFER_TOO_SMALL);
+    CHECK(length == strlen("ubuntu-jammy-22.04-amd64-server-20240201"));
+    CHECK(ss_item_hash(product, NULL, NULL, buf, 4, &length) == SS_ERR_BUFFER_TOO_SMALL && length == 4);
+    CHECK(ss_item_hash(product, NULL, NULL, buf, 5, &length) == SS_OK && length == 4);
+    ss_product_free(product);
+}
+
+static void testSupported(const ss_catalog *catalog)
+{
+    ss_product *products[2] = {NULL, NULL};
+    size_t count = 0;
+    CHECK(ss_supported(catalog, products, 1, &count) == SS_ERR_BUFFER_TOO_SMALL);
+    CHECK(count == 2 && products[0] == NULL);
+    CHECK(ss_supported(catalog, NULL, 0, &count) == SS_ERR_BUFFER_TOO_SMALL && count == 2);
+    CHECK(ss_supported(catalog, products, 2, &count) == SS_OK && count == 2);
+    ss_product_free(products[0]);
+    ss_product_free(products[1]);
+}
+
+int main(void)
+{
+    ss_catalog *catalog = NULL;
+    CHECK(ss_abi_version() == SS_ABI_VERSION);
+    testOpen();
+    CHECK(ss_catalog_open(DOCUMENT, sizeof(DOCUMENT) - 1, &catalog) == SS_OK);
+    if (catalog) {
+        testFind(catalog);
+        testItemHash(catalog);
+        testSupported(catalog);
+        ss_catalog_close(catalog);
+    }
+    if (g_failures) {
+        printf("%d check(s) failed\n", g_failures);
+        return EXIT_FAILURE;
+    }
+    printf("All checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+///
+/// @brief Checks of the hand-written parsers: Cache-Control and Expires
+/// handling, clearsigned document unwrapping, sparse image writing and the
+/// reuse of cached file digests.
+///
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "download.h"
+#include "signature.h"
+
+namespace {
+
+int g_failures = 0;
+
+void check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        std::cout << "FAILED line " << line << ": " << what << '\n';
+        ++g_failures;
+    }
+}
+
+#define CHECK(expr) check((expr), #expr, __LINE__)
+
+/// @return whether `body` throws std::runtime_error
+template<typename F>
+bool throws(F &&body)
+{
+    try {
+        body();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+/// @return the seconds until a document with the given headers expires,
+/// rounded to the nearest second
+long long ttl(const CachePolicy &policy, const std::string &cacheControl, const std::string &expires = {},
+              const std::string &date = {}, const std::string &age = {})
+{
+    const auto left = policy.expiry(cacheControl, expires, date, age) - std::chrono::system_clock::now();
+    return std::chrono::round<std::chrono::seconds>(left).count();
+}
+
+void testCachePolicy()
+{
+    CachePolicy policy;
+    policy.jitter = 0;
+    CHECK(ttl(policy, "max-age=600") == 600);
+    CHECK(ttl(policy, "public, Max-Age=600 ") == 600);
+    CHECK(ttl(policy, "max-age=600", "", "", "100") == 500);
+    CHECK(ttl(policy, "max-age=600", "", "", "900") == 0);
+    CHECK(ttl(policy, "max-age=600", "", "", "bogus") == 600);
+    CHECK(ttl(policy, "max-age=x") == 0);
+    CHECK(ttl(policy, "max-age=-5") == 0);
+    CHECK(ttl(policy, "no-cache, max-age=600") == 0);
+    CHECK(ttl(policy, "") == CACHE_TTL.count());
+
+    // Expires is relative to Date, and invalid means already expired.
+    CHECK(ttl(policy, "", "Sun, 06 Nov 1994 08:49:37 GMT", "Sun, 06 Nov 1994 08:39:37 GMT") == 600);
+    CHECK(ttl(policy, "", "Sun, 06 Nov 1994 08:39:37 GMT", "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+    CHECK(ttl(policy, "", "0") == 0);
+    CHECK(ttl(policy, "", "Sun, 06 Nov 1994 08:49:37") == 0);
+    CHECK(ttl(policy, "max-age=60", "0") == 60);
+
+    policy.minTtl = std::chrono::seconds(120);
+    policy.maxTtl = std::chrono::seconds(300);
+    CHECK(ttl(policy, "max-age=60") == 120);
+    CHECK(ttl(policy, "max-age=600") == 300);
+    CHECK(ttl(policy, "", "0") == 120);
+
+    // Jitter never takes the expiry below the minimum, and still spreads
+    //  expiries when the maximum applies.
+    policy.jitter = 1;
+    std::set<long long> spread;
+    for (int i = 0; i < 100; ++i) {
+        const auto seconds = ttl(policy, "max-age=200");
+        CHECK(seconds >= 120 && seconds <= 200);
+        const auto bounded = ttl(policy, "max-age=600");
+        CHECK(bounded >= 120 && bounded <= 300);
+        spread.insert(bounded);
+    }
+    CHECK(spread.size() > 1);
+    CHECK(ttl(policy, "max-age=60") == 120);
+
+    CHECK(CachePolicy::storable(""));
+    CHECK(CachePolicy::storable("max-age=60, private"));
+    CHECK(!CachePolicy::storable("public, No-Store"));
+}
+
+void testSignedText()
+{
+    const std::string signature = "-----BEGIN PGP SIGNATURE-----\n\niQEz\n-----END PGP SIGNATURE-----\n";
+
+    const std::string escaped = "-----BEGIN PGP SIGNED MESSAGE-----\nHash: SHA512\n\n"
+                                "{\"a\": 1,\n- -----not a header\n- - dashes\n\"b\": 2}\n" + signature;
+    CHECK(Signature::signedText(escaped) == "{\"a\": 1,\n-----not a header\n- dashes\n\"b\": 2}\n");
+
+    // A blank line inside the text must not be taken for the end of the
+    //  armor headers.
+    const std::string noBlank = "-----BEGIN PGP SIGNED MESSAGE-----\nHash: SHA512\n"
+                                "{\"a\": 1,\n\n\"b\": 2}\n" + signature;
+    CHECK(throws([&] { Signature::signedText(noBlank); }));
+
+    const std::string noHeaders = "-----BEGIN PGP SIGNED MESSAGE-----\n\n{}\n" + signature;
+    CHECK(Signature::signedText(noHeaders) == "{}\n");
+
+    const std::string empty = "-----BEGIN PGP SIGNED MESSAGE-----\nHash: SHA256\n\n" + signature;
+    CHECK(Signature::signedText(empty).empty());
+
+    CHECK(throws([] { Signature::signedText("{\"a\": 1}"); }));
+    CHECK(throws([] { Signature::signedText("-----BEGIN PGP SIGNED MESSAGE-----\nHash: SHA512\n\n{}\n"); }));
+    CHECK(throws([] { Signature::signedText("-----BEGIN PGP SIGNED MESSAGE-----\nHash: SHA512"); }));
+}
+
+/// Write `image` with an ImageWriter in chunks of `chunk` bytes.
+/// @return whether the file written has the content of `image`
+bool writeImage(const std::filesystem::path &path, const std::string &image, std::size_t chunk,
+                std::uint64_t expectedSize)
+{
+    ImageWriter writer(path.string(), expectedSize);
+    for (std::size_t offset = 0; offset < image.size(); offset += chunk) {
+        writer.write(image.data() + offset, std::min(chunk, image.size() - offset));
+    }
+    if (writer.commit(Sha256::hex(image)) != Sha256::hex(image))
+        return false;
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream written;
+    written << file.rdbuf();
+    return written.str() == image && !std::filesystem::exists(path.string() + ".part");
+}
+
+void testImageWriter()
+{
+    const auto dir = std::filesystem::temp_directory_path() /
+        ("simplestream_tests_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    const auto path = dir / "image";
+
+    std::string data(SPARSE_BLOCK_SIZE, 'x');
+    std::string zeroes(SPARSE_BLOCK_SIZE, '\0');
+    // Trailing partial zero block, and zero runs in the middle and at the end.
+    const std::string image = data + zeroes + zeroes + data + std::string(1000, '\0');
+    for (std::size_t chunk : {std::size_t(1000), SPARSE_BLOCK_SIZE, image.size()}) {
+        CHECK(writeImage(path, image, chunk, image.size()));
+        CHECK(writeImage(path, image, chunk, 0));
+    }
+    CHECK(writeImage(path, zeroes + zeroes + std::string(17, '\0'), 4096, 0));
+    CHECK(writeImage(path, std::string(), 4096, 0));
+    CHECK(writeImage(path, zeroes + "tail", SPARSE_BLOCK_SIZE, 0));
+
+    // A checksum mismatch leaves neither the image nor the partial file.
+    std::filesystem::remove(path);
+    CHECK(throws([&] {
+        ImageWriter writer(path.string(), 0);
+        writer.write(data.data(), data.size());
+        writer.commit(Sha256::hex("other"));
+    }));
+    CHECK(!std::filesystem::exists(path) && !std::filesystem::exists(path.string() + ".part"));
+
+    std::filesystem::remove_all(dir);
+}
+
+void testFileDigest()
+{
+    const auto dir = std::filesystem::temp_directory_path() /
+        ("simplestream_tests_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir / "cache");
+    const DocumentCache cache(dir / "cache");
+    const FileDigest digests(&cache);
+    const auto path = (dir / "file").string();
+    std::ofstream(path) << "first";
+
+    // Plant a digest for the current stamp: an unchanged file reuses it.
+    auto plant = [&] {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        const auto stamp = FileStamp::of(fd);
+        close(fd);
+        return stamp && cache.storeDigest({*stamp, "planted", {}});
+    };
+    CHECK(digests.sha256(path) == Sha256::hex("first"));
+    CHECK(plant());
+    CHECK(digests.sha256(path) == "planted");
+
+    // A changed ctime, here from a chmod, means hashing the file again.
+    //  Sleep past the granularity of the file system's timestamps.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(chmod(path.c_str(), 0600) == 0);
+    CHECK(digests.sha256(path) == Sha256::hex("first"));
+
+    // So does a changed size.
+    CHECK(plant());
+    std::ofstream(path, std::ios::app) << "second";
+    CHECK(digests.sha256(path) == Sha256::hex("firstsecond"));
+
+    // Without a cache, the file is always hashed.
+    CHECK(FileDigest(nullptr).sha256(path) == Sha256::hex("firstsecond"));
+
+    std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+int main()
+{
+    testCachePolicy();
+    testSignedText();
+    testImageWriter();
+    testFileDigest();
+    if (g_failures) {
+        std::cout << g_failures << " check(s) failed\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "All checks passed\n";
+    return EXIT_SUCCESS;
+}
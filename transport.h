@@ -0,0 +1,348 @@
+///
+/// @brief Transports that fetch documents for the Simplestream classes.
+/// @details HttpTransport fetches from a server. RecordingTransport saves the
+/// exchanges of another transport to a cassette file, including when each
+/// chunk of a body arrived, and ReplayTransport plays a cassette back offline
+/// with the original or scaled timing.
+///
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <jsoncpp/json/json.h>
+#include <httplib.h>
+
+///
+/// @brief Receives the body of a response as it arrives. Return false to stop
+/// the transfer early.
+///
+using ChunkReceiver = std::function<bool(const char *data, std::size_t size)>;
+
+///
+/// @brief The status line and headers of a response.
+///
+struct ResponseHead {
+    int status = 0;
+    httplib::Headers headers;
+
+    /// @return the first value of the header `name`, or an empty string
+    std::string header(const std::string &name) const {
+        const auto found = headers.find(name);
+        return found == headers.end() ? std::string() : found->second;
+    }
+};
+
+///
+/// @brief Fetches resources by path from a single origin.
+///
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    /// Fetch `path` with the request `headers`, passing the body to
+    /// `receiver` as it arrives.
+    /// @throws std::runtime_error if the resource couldn't be fetched
+    virtual ResponseHead get(const std::string &path, const httplib::Headers &headers,
+                             const ChunkReceiver &receiver) = 0;
+
+    /// Start connecting in the background in anticipation of fetching `path`,
+    /// if the transport needs a connection at all. A later get() waits for
+    /// the connection to be ready. Only call it when a get() follows, since
+    /// destroying the transport waits for the warm-up as well.
+    virtual void warmUp(const std::string &path) { (void)path; }
+
+    /// Fetch `path`, appending the whole body to `body`.
+    /// @throws std::runtime_error if the resource couldn't be fetched
+    ResponseHead get(const std::string &path, std::string &body, const httplib::Headers &headers = {}) {
+        return get(path, headers, [&](const char *data, std::size_t size) {
+            body.append(data, size);
+            return true;
+        });
+    }
+};
+
+///
+/// @brief Fetches over HTTP or HTTPS with httplib.
+/// @details The client, and with it the TLS context and CA store of an HTTPS
+/// origin, is only created by the first fetch or warm-up. Invocations that
+/// never fetch, such as replays, don't pay for TLS setup.
+///
+class HttpTransport : public Transport {
+public:
+    using Transport::get;
+
+    /// @param origin scheme, host and optional port, e.g. "https://example.com"
+    explicit HttpTransport(std::string origin) : m_origin(std::move(origin)) {}
+
+    /// Waits for a warm-up still in progress, so that it isn't inside httplib
+    /// or OpenSSL while the process exits. httplib can't interrupt a connect
+    /// or TLS handshake, but a warm-up is only started when a get() follows,
+    /// which waits for it anyway.
+    ~HttpTransport() override {
+        if (m_warmUp.joinable())
+            m_warmUp.join();
+    }
+
+    ResponseHead get(const std::string &path, const httplib::Headers &headers,
+                     const ChunkReceiver &receiver) override {
+        // Waits for a warm-up in progress, leaving its connection ready.
+        std::lock_guard lock(m_mutex);
+        auto &client = getClient();
+        ResponseHead ret;
+        bool stopped = false;
+        auto reply = client.Get(path, headers,
+            [&](const httplib::Response &res) {
+                ret.status = res.status;
+                ret.headers = res.headers;
+                return true;
+            },
+            [&](const char *data, std::size_t size) {
+                stopped = !receiver(data, size);
+                return !stopped;
+            });
+        // Stopping early at the receiver's request isn't a failure.
+        if (!reply && !(stopped && reply.error() == httplib::Error::Canceled)) {
+            std::ostringstream msg;
+            msg << "error code: " << reply.error();
+            auto result = client.get_openssl_verify_result();
+            if (result) {
+                msg << ", verify error: " << X509_verify_cert_error_string(result);
+            }
+            throw std::runtime_error(msg.str());
+        }
+        return ret;
+    }
+
+    /// Resolves, connects and completes the TLS handshake on another thread
+    /// with a HEAD request, leaving a kept-alive connection for get().
+    void warmUp(const std::string &path) override {
+        if (m_warmUp.joinable())
+            return;
+        m_warmUp = std::thread([this, path] {
+            std::lock_guard lock(m_mutex);
+            getClient().Head(path);
+        });
+    }
+
+private:
+    /// @return the client, created on first use. The caller holds m_mutex.
+    httplib::Client& getClient() {
+        if (!m_client) {
+            m_client = std::make_unique<httplib::Client>(m_origin);
+            m_client->set_keep_alive(true);
+        }
+        return *m_client;
+    }
+
+    std::string m_origin;
+    std::mutex m_mutex;
+    std::unique_ptr<httplib::Client> m_client;
+    std::thread m_warmUp;
+};
+
+// Version of the cassette file format, bumped on incompatible changes.
+constexpr int CASSETTE_FORMAT = 2;
+
+///
+/// @brief Cassette files of recorded exchanges.
+/// @details A cassette is a JSON document with the "format" version and an
+/// "exchanges" array. Each exchange has the "path" requested, the response
+/// "status" and "headers", and the "chunks" of the body, each with its
+/// base64 "data" and the milliseconds from the request to its arrival
+/// ("at_ms"). Bodies are base64-encoded because JSON strings can't hold
+/// arbitrary bytes: jsoncpp would replace invalid UTF-8.
+///
+class Cassette {
+public:
+    static Json::Value load(const std::string &path) {
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("Cannot open cassette " + path);
+        Json::Value root;
+        Json::Reader reader;
+        if (!reader.parse(file, root))
+            throw std::runtime_error(reader.getFormattedErrorMessages());
+        if (!root.isObject() || root["format"].asInt() != CASSETTE_FORMAT || !root["exchanges"].isArray())
+            throw std::runtime_error(path + " is not a cassette, or was recorded by another version");
+        return root;
+    }
+
+    static void save(const std::string &path, const Json::Value &root) {
+        std::ofstream file(path);
+        Json::StreamWriterBuilder writer;
+        writer["indentation"] = "";
+        file << Json::writeString(writer, root) << '\n';
+        if (!file)
+            throw std::runtime_error("Cannot write cassette " + path);
+    }
+
+    /// @return `data` in base64
+    static std::string encode(std::string_view data) {
+        std::string ret;
+        ret.reserve((data.size() + 2) / 3 * 4);
+        for (std::size_t i = 0; i < data.size(); i += 3) {
+            const std::size_t take = std::min<std::size_t>(3, data.size() - i);
+            std::uint32_t group = 0;
+            for (std::size_t j = 0; j < 3; ++j) {
+                group = group << 8 | (j < take ? static_cast<unsigned char>(data[i + j]) : 0u);
+            }
+            for (std::size_t j = 0; j < 4; ++j) {
+                ret += j <= take ? BASE64[group >> (18 - 6 * j) & 0x3f] : '=';
+            }
+        }
+        return ret;
+    }
+
+    /// @return the data encoded in base64 `text`
+    /// @throws std::runtime_error if `text` isn't base64
+    static std::string decode(std::string_view text) {
+        if (text.size() % 4 != 0)
+            throw std::runtime_error("Cassette chunk is not base64");
+        std::string ret;
+        ret.reserve(text.size() / 4 * 3);
+        for (std::size_t i = 0; i < text.size(); i += 4) {
+            std::uint32_t group = 0;
+            std::size_t padding = 0;
+            for (std::size_t j = 0; j < 4; ++j) {
+                const char c = text[i + j];
+                const char *digit = c ? std::strchr(BASE64, c) : nullptr;
+                // Padding may only end the text.
+                if (c == '=' && i + 4 == text.size() && j >= 2) {
+                    ++padding;
+                    digit = BASE64;
+                } else if (!digit || padding) {
+                    throw std::runtime_error("Cassette chunk is not base64");
+                }
+                group = group << 6 | static_cast<std::uint32_t>(digit - BASE64);
+            }
+            for (std::size_t j = 0; j < 3 - padding; ++j) {
+                ret += static_cast<char>(group >> (16 - 8 * j) & 0xff);
+            }
+        }
+        return ret;
+    }
+
+private:
+    static constexpr const char *BASE64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+};
+
+///
+/// @brief Records the exchanges of another transport to a cassette file.
+/// @details The cassette is rewritten after each exchange, so it is complete
+/// even if the process exits without unwinding.
+///
+class RecordingTransport : public Transport {
+public:
+    using Transport::get;
+
+    RecordingTransport(std::unique_ptr<Transport> inner, std::string cassette)
+        : m_inner(std::move(inner)), m_cassette(std::move(cassette)) {
+        m_root["format"] = CASSETTE_FORMAT;
+        m_root["exchanges"] = Json::arrayValue;
+    }
+
+    void warmUp(const std::string &path) override { m_inner->warmUp(path); }
+
+    ResponseHead get(const std::string &path, const httplib::Headers &headers,
+                     const ChunkReceiver &receiver) override {
+        Json::Value exchange;
+        exchange["path"] = path;
+        Json::Value &chunks = exchange["chunks"] = Json::arrayValue;
+        const auto start = std::chrono::steady_clock::now();
+        const ResponseHead ret = m_inner->get(path, headers, [&](const char *data, std::size_t size) {
+            const std::chrono::duration<double, std::milli> at = std::chrono::steady_clock::now() - start;
+            Json::Value chunk;
+            chunk["at_ms"] = at.count();
+            chunk["data"] = Cassette::encode(std::string_view(data, size));
+            chunks.append(std::move(chunk));
+            return receiver(data, size);
+        });
+        exchange["status"] = ret.status;
+        Json::Value &recorded = exchange["headers"] = Json::arrayValue;
+        for (const auto &[name, value] : ret.headers) {
+            Json::Value header(Json::arrayValue);
+            header.append(name);
+            header.append(value);
+            recorded.append(std::move(header));
+        }
+        m_root["exchanges"].append(std::move(exchange));
+        Cassette::save(m_cassette, m_root);
+        return ret;
+    }
+
+private:
+    std::unique_ptr<Transport> m_inner;
+    std::string m_cassette;
+    Json::Value m_root;
+};
+
+///
+/// @brief Replays the exchanges recorded in a cassette file, without network.
+/// @details Exchanges for the same path are replayed in the order they were
+/// recorded, and the last one repeats. Each chunk is delivered at its
+/// recorded arrival time multiplied by the timing scale, so 1 reproduces the
+/// original timing and 0 delivers everything immediately.
+///
+class ReplayTransport : public Transport {
+public:
+    using Transport::get;
+
+    explicit ReplayTransport(const std::string &cassette, double scale = 1.0)
+        : m_root(Cassette::load(cassette)), m_scale(scale) {
+        for (const auto &exchange : m_root["exchanges"]) {
+            m_exchanges[exchange["path"].asString()].recorded.push_back(&exchange);
+        }
+    }
+
+    /// Request headers are ignored: the exchanges for a path replay in order.
+    ResponseHead get(const std::string &path, const httplib::Headers&,
+                     const ChunkReceiver &receiver) override {
+        const auto found = m_exchanges.find(path);
+        if (found == m_exchanges.end())
+            throw std::runtime_error("No recorded exchange for " + path);
+        auto &[exchanges, next] = found->second;
+        const Json::Value &exchange = *exchanges[std::min(next, exchanges.size() - 1)];
+        ++next;
+
+        ResponseHead ret;
+        ret.status = exchange["status"].asInt();
+        for (const auto &header : exchange["headers"]) {
+            ret.headers.emplace(header[0].asString(), header[1].asString());
+        }
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto &chunk : exchange["chunks"]) {
+            if (m_scale > 0) {
+                const std::chrono::duration<double, std::milli> at(chunk["at_ms"].asDouble() * m_scale);
+                std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(at));
+            }
+            const std::string data = Cassette::decode(chunk["data"].asString());
+            if (!receiver(data.data(), data.size()))
+                break;
+        }
+        return ret;
+    }
+
+private:
+    struct Exchanges {
+        std::vector<const Json::Value*> recorded;
+        std::size_t next = 0;
+    };
+
+    Json::Value m_root;
+    double m_scale;
+    std::map<std::string, Exchanges> m_exchanges;
+};